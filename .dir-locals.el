@@ -12,7 +12,6 @@
           (flycheck-clang-include-path
            "/usr/include/april-ann"
            "/usr/include/lua5.2"
-           "/usr/local/include/hat-trie"
            )
           )
          )
@@ -22,7 +21,6 @@
             (flycheck-clang-include-path
              "/usr/include/april-ann"
              "/usr/include/lua5.2"
-             "/usr/local/include/hat-trie"
              )
             )
            )
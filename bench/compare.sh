@@ -0,0 +1,36 @@
+#!/bin/bash
+#
+# This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+# Lua).
+#
+# Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+#
+# Arpa2Lira is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License version 3 as published by the
+# Free Software Foundation
+#
+# This library is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+# Place, Suite 330, Boston, MA 02111-1307 USA
+#
+# Compares the wall time and peak RSS of every phase of two results files
+# written by run_bench.sh, usually of two commits
+if [ $# != 2 ]; then
+    echo "usage: $0 old.tsv new.tsv" >&2
+    exit 1
+fi
+awk -F'\t' '
+  BEGIN { printf "%-8s %-22s %-22s %10s %10s %7s %10s %10s\n", "size",
+          "config", "phase", "old", "new", "speedup", "old_rss", "new_rss" }
+  FNR == 1 { next }
+  NR == FNR { wall[$1 FS $2 FS $3] = $4; rss[$1 FS $2 FS $3] = $8; next }
+  ($1 FS $2 FS $3) in wall {
+    k = $1 FS $2 FS $3
+    printf "%-8s %-22s %-22s %9.3fs %9.3fs %6.2fx %8.1fMB %8.1fMB\n",
+      $1, $2, $3, wall[k], $4, ($4 > 0) ? wall[k]/$4 : 0, rss[k], $8
+  }' "$1" "$2"
@@ -0,0 +1,239 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "april-ann.h"
+
+// Deterministic generator of synthetic ARPA models and their vocabulary.
+// Word 0 is <s>, word 1 is </s> and the rest are w0, w1, ... by decreasing
+// Zipf frequency. Every n-gram extends a random (n-1)-gram prefix with a
+// word which follows its suffix context at the lower level, chosen with a
+// Zipf distribution over the order of appearance of the followers, so prefixes and
+// suffixes of every n-gram are in the model, as in a real backoff model.
+
+typedef std::vector<int> Ngram;
+
+struct NgramHash {
+  size_t operator()(const Ngram &v) const {
+    size_t h = 14695981039346656037ull;
+    for (size_t i=0; i<v.size(); ++i) {
+      h = (h ^ static_cast<size_t>(v[i])) * 1099511628211ull;
+    }
+    return h;
+  }
+};
+
+typedef std::unordered_map<Ngram, std::vector<int>, NgramHash> ChildrenMap;
+
+const int BEGIN_WORD = 0;
+const int END_WORD   = 1;
+
+// Samples ranks in [0,n) with probability proportional to 1/(rank+1)^s
+class ZipfSampler {
+  std::vector<double> cdf;
+  double exponent;
+public:
+  explicit ZipfSampler(double s) : exponent(s) { }
+  int sample(std::mt19937_64 &rng, size_t n) {
+    while (cdf.size() < n) {
+      double prev = cdf.empty() ? 0.0 : cdf.back();
+      cdf.push_back(prev + 1.0 / pow(static_cast<double>(cdf.size() + 1),
+                                     exponent));
+    }
+    std::uniform_real_distribution<double> dist(0.0, cdf[n-1]);
+    return std::upper_bound(cdf.begin(), cdf.begin() + n, dist(rng)) -
+      cdf.begin();
+  }
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-s seed] [-z zipf_exponent] [-t num_sentences] "
+          "vocab_size count2 [count3 ...] output_prefix\n"
+          "writes output_prefix.vocab and output_prefix.arpa, the model "
+          "has an n-gram level for every count, and output_prefix.test "
+          "when the number of test sentences is given\n", prog);
+  exit(1);
+}
+
+static void write_word(FILE *f, int w) {
+  if (w == BEGIN_WORD) fputs("<s>", f);
+  else if (w == END_WORD) fputs("</s>", f);
+  else fprintf(f, "w%d", w - 2);
+}
+
+int main(int argc, char **argv) {
+  unsigned long seed = 1234;
+  double zipf_exponent = 1.0;
+  int num_sentences = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:z:t:")) != -1) {
+    switch (opt) {
+    case 's':
+      seed = strtoul(optarg, 0, 10);
+      break;
+    case 'z':
+      zipf_exponent = atof(optarg);
+      if (zipf_exponent <= 0.0) usage(argv[0]);
+      break;
+    case 't':
+      num_sentences = atoi(optarg);
+      if (num_sentences < 1) usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind < 3) usage(argv[0]);
+  const int vocab_size = atoi(argv[optind]);
+  if (vocab_size < 3) usage(argv[0]);
+  std::vector<size_t> counts(1, vocab_size);
+  for (int i=optind+1; i<argc-1; ++i) {
+    if (atoi(argv[i]) < 1) usage(argv[0]);
+    counts.push_back(atoi(argv[i]));
+  }
+  const int order = counts.size();
+  const std::string prefix(argv[argc-1]);
+  
+  std::mt19937_64 rng(seed);
+  ZipfSampler zipf(zipf_exponent);
+  std::vector< std::vector<Ngram> > levels(order);
+  for (int w=0; w<vocab_size; ++w) levels[0].push_back(Ngram(1, w));
+  for (int n=2; n<=order; ++n) {
+    const std::vector<Ngram> &lower = levels[n-2];
+    // words following every (n-2)-gram context at the lower level
+    ChildrenMap children;
+    std::vector<size_t> prefixes;
+    for (size_t i=0; i<lower.size(); ++i) {
+      const Ngram &g = lower[i];
+      if (g.back() != BEGIN_WORD) {
+        children[Ngram(g.begin(), g.end()-1)].push_back(g.back());
+      }
+      if (g.back() != END_WORD) prefixes.push_back(i);
+    }
+    std::unordered_set<Ngram, NgramHash> level;
+    std::uniform_int_distribution<size_t> prefix_dist;
+    const size_t max_attempts = 20u * counts[n-1];
+    for (size_t attempt=0; attempt<max_attempts &&
+           level.size() < counts[n-1]; ++attempt) {
+      const Ngram &p = lower[prefixes[prefix_dist(rng) % prefixes.size()]];
+      const std::vector<int> &next = children[Ngram(p.begin()+1, p.end())];
+      if (next.empty()) continue;
+      Ngram g(p);
+      g.push_back(next[zipf.sample(rng, next.size())]);
+      level.insert(g);
+    }
+    if (level.size() < counts[n-1]) {
+      fprintf(stderr, "Only %lu %d-grams could be generated\n",
+              (unsigned long)level.size(), n);
+    }
+    levels[n-1].assign(level.begin(), level.end());
+    std::sort(levels[n-1].begin(), levels[n-1].end());
+  }
+
+  std::string vocab_filename = prefix + ".vocab";
+  FILE *f = fopen(vocab_filename.c_str(), "w");
+  if (f == 0) ERROR_EXIT1(1, "Unable to open %s\n", vocab_filename.c_str());
+  for (int w=0; w<vocab_size; ++w) {
+    write_word(f, w);
+    fputc('\n', f);
+  }
+  fclose(f);
+
+  std::string arpa_filename = prefix + ".arpa";
+  f = fopen(arpa_filename.c_str(), "w");
+  if (f == 0) ERROR_EXIT1(1, "Unable to open %s\n", arpa_filename.c_str());
+  fprintf(f, "\n\\data\\\n");
+  for (int n=1; n<=order; ++n) {
+    fprintf(f, "ngram %d=%lu\n", n, (unsigned long)levels[n-1].size());
+  }
+  std::uniform_real_distribution<float> prob_dist(-4.0f, -0.05f);
+  std::uniform_real_distribution<float> backoff_dist(-1.5f, 0.0f);
+  std::uniform_real_distribution<float> coin(0.0f, 1.0f);
+  for (int n=1; n<=order; ++n) {
+    fprintf(f, "\n\\%d-grams:\n", n);
+    for (size_t i=0; i<levels[n-1].size(); ++i) {
+      const Ngram &g = levels[n-1][i];
+      float prob;
+      if (n == 1) { // Zipf unigrams
+        prob = (g[0] == BEGIN_WORD) ? -99.0f :
+          -zipf_exponent*log10(static_cast<double>(g[0])) - 1.0f;
+      }
+      else {
+        prob = prob_dist(rng);
+      }
+      fprintf(f, "%.6g\t", prob);
+      for (int j=0; j<n; ++j) {
+        if (j > 0) fputc(' ', f);
+        write_word(f, g[j]);
+      }
+      // n-grams without backoff weight are allowed by the ARPA format
+      if (n < order && g.back() != END_WORD && coin(rng) < 0.9f) {
+        fprintf(f, "\t%.6g", backoff_dist(rng));
+      }
+      fputc('\n', f);
+    }
+  }
+  fprintf(f, "\n\\end\\\n");
+  fclose(f);
+
+  // Test sentences mix fragments of the highest order n-grams, which are
+  // found in the model, with Zipf words, which mostly need backoff, and a
+  // few words out of the vocabulary
+  if (num_sentences > 0) {
+    std::string test_filename = prefix + ".test";
+    f = fopen(test_filename.c_str(), "w");
+    if (f == 0) ERROR_EXIT1(1, "Unable to open %s\n", test_filename.c_str());
+    const std::vector<Ngram> &top = levels[order-1];
+    std::uniform_int_distribution<size_t> top_dist(0u, top.size() - 1u);
+    std::uniform_int_distribution<int> length_dist(5, 25);
+    for (int s=0; s<num_sentences; ++s) {
+      const int length = length_dist(rng);
+      int written = 0;
+      while (written < length) {
+        const float c = coin(rng);
+        if (c < 0.5f) {
+          const Ngram &g = top[top_dist(rng)];
+          for (size_t j=0; j<g.size(); ++j) {
+            if (g[j] == BEGIN_WORD || g[j] == END_WORD) continue;
+            if (written++ > 0) fputc(' ', f);
+            write_word(f, g[j]);
+          }
+        }
+        else {
+          if (written++ > 0) fputc(' ', f);
+          if (c < 0.99f) write_word(f, 2 + zipf.sample(rng, vocab_size - 2));
+          else fputs("<unk>", f);
+        }
+      }
+      fputc('\n', f);
+    }
+    fclose(f);
+  }
+  return 0;
+}
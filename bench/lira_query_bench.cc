@@ -0,0 +1,219 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+#include "april-ann.h"
+
+#include "arpa_input.h"
+#include "lira_scorer.h"
+#include "metrics.h"
+
+using namespace Arpa2Lira;
+using AprilUtils::constString;
+using AprilUtils::UniquePtr;
+
+// Loads a LIRA model, text or binary, and scores a test set of one sentence
+// per line, reporting its perplexity and the queries per second of the
+// scoring loop. A query is the score of one word given its context,
+// including the end of every sentence. Sentences are scored one query at a
+// time, and in groups which advance one word per step, as the hypotheses of
+// a decoder, with all the queries of a step given to score_batch().
+
+struct TestSet {
+  std::vector<unsigned int> words;
+  std::vector<size_t> sentences; // first word of every sentence and the end
+  int num_words;
+};
+
+// Words out of the vocabulary keep VocabDictionary::UNKNOWN_WORD, <s> and
+// </s> marks of the test set are ignored
+static void read_test_set(const char *filename, const LiraScorer &scorer,
+                          TestSet &test) {
+  const VocabDictionary &vocab = scorer.get_vocab();
+  const unsigned int begin_word = vocab("<s>");
+  UniquePtr<ArpaInput> input(ArpaInput::open(filename));
+  test.num_words = 0;
+  test.sentences.push_back(0u);
+  for (constString block = input->acquire(); block.len() > 0;
+       block = input->acquire()) {
+    while (block.len() > 0) {
+      constString line = block.extract_line();
+      constString token;
+      while ((token = line.extract_token(" \t\r")).len() > 0) {
+        const unsigned int id = vocab(token);
+        if (id != VocabDictionary::UNKNOWN_WORD &&
+            (id == begin_word || id == scorer.get_end_word())) continue;
+        test.words.push_back(id);
+        ++test.num_words;
+      }
+      if (test.words.size() > test.sentences.back()) {
+        test.sentences.push_back(test.words.size());
+      }
+    }
+    input->release();
+  }
+}
+
+static double score_single(const LiraScorer &scorer, const TestSet &test,
+                           int &num_oovs) {
+  const int num_sentences = static_cast<int>(test.sentences.size()) - 1;
+  double logprob = 0.0;
+  num_oovs = 0;
+  for (int s=0; s<num_sentences; ++s) {
+    int oovs;
+    const size_t first = test.sentences[s];
+    logprob += scorer.score_sentence(test.words.data() + first,
+                                     test.sentences[s+1] - first, &oovs);
+    num_oovs += oovs;
+  }
+  return logprob;
+}
+
+// Adds the scores of every sentence in the same order as score_sentence(),
+// so both paths give the same log probability
+static double score_batched(const LiraScorer &scorer, const TestSet &test,
+                            int group, int &num_oovs) {
+  const int num_sentences = static_cast<int>(test.sentences.size()) - 1;
+  std::vector<int> states(group), batch_states(group), batch_sentences(group);
+  std::vector<unsigned int> batch_words(group);
+  std::vector<float> sums(group), batch_logprobs(group);
+  double logprob = 0.0;
+  num_oovs = 0;
+  for (int base=0; base<num_sentences; base+=group) {
+    const int g = AprilUtils::min(group, num_sentences - base);
+    for (int i=0; i<g; ++i) {
+      states[i] = scorer.get_initial_state();
+      sums[i]   = 0.0f;
+    }
+    for (size_t pos=0; ; ++pos) {
+      int n = 0;
+      for (int i=0; i<g; ++i) {
+        const size_t first  = test.sentences[base+i];
+        const size_t length = test.sentences[base+i+1] - first;
+        if (pos > length) continue;
+        batch_sentences[n] = i;
+        batch_states[n]    = states[i];
+        batch_words[n]     = (pos < length) ?
+          test.words[first + pos] : scorer.get_end_word();
+        ++n;
+      }
+      if (n == 0) break;
+      scorer.score_batch(batch_states.data(), batch_words.data(),
+                         batch_logprobs.data(), n);
+      for (int k=0; k<n; ++k) {
+        const int i = batch_sentences[k];
+        states[i] = batch_states[k];
+        if (batch_logprobs[k] <= LiraScorer::LOG_ZERO) ++num_oovs;
+        else sums[i] += batch_logprobs[k];
+      }
+    }
+    for (int i=0; i<g; ++i) logprob += sums[i];
+  }
+  return logprob;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-r repetitions] [-g group_size] "
+          "[-m metrics.json] lira_filename test_filename\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int repetitions = 1;
+  int group = 256;
+  const char *metrics_filename = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:g:m:")) != -1) {
+    switch (opt) {
+    case 'r':
+      repetitions = atoi(optarg);
+      if (repetitions < 1) usage(argv[0]);
+      break;
+    case 'g':
+      group = atoi(optarg);
+      if (group < 1) usage(argv[0]);
+      break;
+    case 'm':
+      metrics_filename = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) usage(argv[0]);
+  const char *lira_filename = argv[optind];
+  const char *test_filename = argv[optind+1];
+
+  Metrics metrics;
+  metrics.begin("load");
+  UniquePtr<LiraScorer> scorer(LiraScorer::load(lira_filename));
+  metrics.end(scorer->get_num_transitions(), scorer->get_memory_size());
+  fprintf(stderr, "%s: order %d, %d states, %d transitions, %.1f MB, "
+          "loaded in %.3fs\n", lira_filename, scorer->get_ngram_order(),
+          scorer->get_num_states(), scorer->get_num_transitions(),
+          scorer->get_memory_size() / double(1u<<20),
+          metrics.get_phases().back().wall_time);
+
+  TestSet test;
+  read_test_set(test_filename, *scorer, test);
+  const int num_sentences = static_cast<int>(test.sentences.size()) - 1;
+
+  const uint64_t num_queries =
+    static_cast<uint64_t>(test.num_words + num_sentences) * repetitions;
+  double logprob = 0.0, batched_logprob = 0.0;
+  int num_oovs = 0, batched_oovs = 0;
+  metrics.begin("score");
+  for (int r=0; r<repetitions; ++r) {
+    logprob = score_single(*scorer, test, num_oovs);
+  }
+  metrics.end(num_queries);
+  const double score_time = metrics.get_phases().back().wall_time;
+  metrics.begin("score-batch");
+  for (int r=0; r<repetitions; ++r) {
+    batched_logprob = score_batched(*scorer, test, group, batched_oovs);
+  }
+  metrics.end(num_queries);
+  const double batched_time = metrics.get_phases().back().wall_time;
+  
+  const int num_scored = test.num_words + num_sentences - num_oovs;
+  printf("%s: %d sentences, %d words, %d OOVs\n", test_filename,
+         num_sentences, test.num_words, num_oovs);
+  printf("logprob= %.4f (log10) ppl= %.4f\n", logprob / M_LN10,
+         exp(-logprob / AprilUtils::max(num_scored, 1)));
+  printf("single: %lu queries in %.3fs, %.0f queries/s\n",
+         (unsigned long)num_queries, score_time,
+         num_queries / AprilUtils::max(score_time, 1e-9));
+  printf("batch: %lu queries in %.3fs, %.0f queries/s, groups of %d, "
+         "speedup %.2f\n", (unsigned long)num_queries, batched_time,
+         num_queries / AprilUtils::max(batched_time, 1e-9), group,
+         score_time / AprilUtils::max(batched_time, 1e-9));
+  if (batched_logprob != logprob || batched_oovs != num_oovs) {
+    fprintf(stderr, "Batched scoring differs: logprob %.6f, %d OOVs\n",
+            batched_logprob / M_LN10, batched_oovs);
+    return 1;
+  }
+  if (metrics_filename != 0) metrics.write_json(metrics_filename);
+  return 0;
+}
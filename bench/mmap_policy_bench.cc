@@ -0,0 +1,113 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdint.h>
+
+#include "april-ann.h"
+
+#include "config.h"
+#include "lm_arrays.h"
+#include "metrics.h"
+
+using namespace Arpa2Lira;
+
+// Page faults and time of the state and transition arrays under every
+// combination of the huge pages and prefault policies, for the three access
+// patterns of the conversion: creation, sequential filling of transitions
+// and random updates of states.
+
+struct Measure {
+  double time;
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  
+  void start() {
+    time = Metrics::get_wall_time();
+    Metrics::get_page_faults(minor_faults, major_faults);
+  }
+  void stop() {
+    uint64_t minor, major;
+    Metrics::get_page_faults(minor, major);
+    time = Metrics::get_wall_time() - time;
+    minor_faults = minor - minor_faults;
+    major_faults = major - major_faults;
+  }
+};
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s num_transitions num_states num_threads\n",
+            argv[0]);
+    exit(1);
+  }
+  const int num_transitions = atoi(argv[1]);
+  const int num_states      = atoi(argv[2]);
+  Config::setNumberOfThreads(atoi(argv[3]));
+  const char *huge_pages_names[] = { "none", "thp", "hugetlb" };
+  const char *prefault_names[]   = { "none", "populate", "parallel" };
+
+  printf("%-8s %-9s %22s %22s %22s\n", "huge", "prefault",
+         "create (s faults)", "fill (s faults)", "random (s faults)");
+  for (int h=Config::HUGE_PAGES_NONE; h<=Config::HUGE_PAGES_EXPLICIT; ++h) {
+    for (int p=Config::PREFAULT_NONE; p<=Config::PREFAULT_PARALLEL; ++p) {
+      Config::setHugePages(static_cast<Config::HugePages>(h));
+      Config::setPrefault(static_cast<Config::Prefault>(p));
+      const int state_bits = bit_width(num_states + 2);
+      Measure create, fill, random;
+      StateArrays states;
+      TransitionArrays transitions;
+      
+      create.start();
+      states.create(num_states, state_bits, 20, 4);
+      transitions.create(num_transitions, state_bits, 20);
+      create.stop();
+      
+      std::mt19937 rng(1234);
+      std::uniform_int_distribution<int> state_dist(0, num_states - 1);
+      fill.start();
+      for (int i=0; i<num_transitions; ++i) {
+        transitions.origin.set(i, i % num_states);
+        transitions.dest.set(i, (i * 7) % num_states);
+        transitions.word.set(i, i % 1000000);
+        transitions.trans_prob[i] = -1.0f;
+      }
+      fill.stop();
+
+      random.start();
+      for (int i=0; i<num_transitions; ++i) {
+        const int st = state_dist(rng);
+        states.fan_out.set(st, states.fan_out.get(st) + 1);
+        states.best_prob[st] = -1.0f;
+      }
+      random.stop();
+
+      printf("%-8s %-9s %8.3f %13lu %8.3f %13lu %8.3f %13lu\n",
+             huge_pages_names[h], prefault_names[p],
+             create.time, (unsigned long)create.minor_faults,
+             fill.time, (unsigned long)fill.minor_faults,
+             random.time, (unsigned long)random.minor_faults);
+      states.release();
+      transitions.release();
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+#!/bin/bash
+#
+# This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+# Lua).
+#
+# Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+#
+# Arpa2Lira is free software; you can redistribute it and/or modify it under
+# the terms of the GNU General Public License version 3 as published by the
+# Free Software Foundation
+#
+# This library is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+# details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+# Place, Suite 330, Boston, MA 02111-1307 USA
+#
+# Converts synthetic models of several sizes with several configurations,
+# checks that equivalent ones produce the same output and stores the per-phase
+# metrics of every run in results/<commit>.tsv, to be compared with
+# compare.sh. Sizes are given by BENCH_SIZES (small medium large). The text
+# and binary outputs are loaded and queried with a synthetic test set of
+# BENCH_SENTENCES sentences. Before that, the tiny models of interpolation/
+# are interpolated and the log-probability of their test set is checked. The
+# bounds of the quantized outputs are checked against their transitions.
+set -e
+cd "$(dirname "$0")"
+
+ARPA2LIRA=../src/arpa2lira
+SENTENCES=${BENCH_SENTENCES:-20000}
+THREADS=${BENCH_THREADS:-4}
+SIZES=${BENCH_SIZES:-"small medium"}
+DATA=data
+RESULTS=results
+LABEL=${BENCH_LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+
+# vocabulary size and counts of the levels 2 to 4
+model_counts() {
+    case $1 in
+        small)  echo "5000 50000 100000 100000" ;;
+        medium) echo "20000 500000 1000000 1000000" ;;
+        large)  echo "50000 2000000 5000000 5000000" ;;
+        *) echo "Unknown size $1" >&2; exit 1 ;;
+    esac
+}
+
+# configuration name and arpa2lira options, the configurations of a group,
+# given by the name up to the first dash, must produce the same output as the
+# first one of the group. The text and binary outputs are queried.
+CONFIGS=(
+    "text:"
+    "text-j$THREADS:-j $THREADS"
+    "text-lowmem:-l"
+    "text-outofcore:-o 4"
+    "text-snapshot:-s $DATA/snapshot"
+    "text-resume:-r $DATA/snapshot"
+    "binary:-b"
+    "binary-j$THREADS-lowmem:-b -j $THREADS -l"
+    "prune:-e 1e-7"
+    "prune-j$THREADS-lowmem:-e 1e-7 -j $THREADS -l"
+    "prune-outofcore:-e 1e-7 -o 4"
+    "mix:"
+    "mix-j$THREADS-lowmem:-j $THREADS -l"
+    "mix-outofcore:-o 4"
+    "quant:-q 8"
+    "quant-j$THREADS-lowmem:-q 8 -j $THREADS -l"
+)
+
+# input arguments of a configuration for the model prefix, the mix group
+# interpolates the model with a second one generated with another seed and
+# the resumed configuration reads the snapshot of the previous one
+config_inputs() {
+    case $1 in
+        mix*)    echo "$2.vocab $2.arpa:0.7 $2-b.arpa:0.3" ;;
+        *resume) ;;
+        *)       echo "$2.vocab $2.arpa" ;;
+    esac
+}
+
+# interpolation/ has two models generated by gen_arpa -t 40 50 300 300 and
+# gen_arpa -s 99 50 200 150, the expected log-probability of the test set was
+# computed from the ARPA files interpolated with weights 0.7 and 0.3
+check_interpolation() {
+    local dir=interpolation
+    local expected=$(cat $dir/logprob)
+    local output=$DATA/interpolation.lira
+    local options logprob
+    for options in "" "-j $THREADS -l" "-o 1" "-b" "-b -q 16"; do
+        $ARPA2LIRA $options $dir/vocab $dir/a.arpa:0.7 $dir/b.arpa:0.3 \
+            $output 2> $DATA/interpolation.log
+        logprob=$(./lira_query_bench -r 1 $output $dir/test \
+            2>> $DATA/interpolation.log | awk '/^logprob=/ { print $2 }')
+        if ! awk -v a=$logprob -v b=$expected \
+            'BEGIN { exit !(a - b < 1e-3 && b - a < 1e-3) }'; then
+            echo "Interpolated log-probability $logprob with options" \
+                "'$options' differs from $expected" >&2
+            exit 1
+        fi
+    done
+    rm -f $output
+    echo "interpolation check passed"
+}
+
+# the bound of every state of a text LIRA model must be the maximum of the
+# probabilities of its transitions and of the states of its backoff chain,
+# added to the backoff weights, and the global bound their maximum
+check_bounds() {
+    awk '
+      function near(a, b) {
+          return a - b <= 1e-4 - 1e-5*b && b - a <= 1e-4 - 1e-5*b
+      }
+      /^#/ { section = $0; next }
+      section ~ /^# bound/ { max_bound = $1 }
+      section ~ /^# backoff_st == -1/ {
+          back[$1] = $2; weight[$1] = $3; bound[$1] = $4; best[$1] = -1e12
+      }
+      section ~ /^# orig dest/ { if ($4 > best[$1]) best[$1] = $4 }
+      END {
+          m = -1e12
+          for (st in bound) {
+              b = best[st]; sum = 0; d = st
+              while (back[d] != -1) {
+                  sum += weight[d]; d = back[d]
+                  if (sum + best[d] > b) b = sum + best[d]
+              }
+              if (!near(b, bound[st])) {
+                  printf "Bound of state %d is %g, expected %g\n",
+                      st, bound[st], b
+                  bad = 1
+              }
+              if (b > m) m = b
+          }
+          if (!near(m, max_bound)) {
+              printf "Max bound is %g, expected %g\n", max_bound, m
+              bad = 1
+          }
+          exit bad
+      }' $1 >&2
+}
+
+# one line per phase: size config phase wall cpu items bytes max_rss_mb
+# minor_faults major_faults
+metrics_to_tsv() {
+    awk -v size=$1 -v config=$2 -F': ' '
+      /"name"/      { gsub(/[",]/, "", $2); name=$2 }
+      /"wall_time"/ { gsub(/,/, "", $2); wall=$2 }
+      /"cpu_time"/  { gsub(/,/, "", $2); cpu=$2 }
+      /"items"/     { gsub(/,/, "", $2); items=$2 }
+      /"bytes"/     { gsub(/,/, "", $2); bytes=$2 }
+      /"minor_faults"/ { gsub(/,/, "", $2); minor=$2 }
+      /"major_faults"/ { gsub(/,/, "", $2); major=$2 }
+      /"max_rss_mb"/ { printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n",
+                       size, config, name, wall, cpu, items, bytes, $2,
+                       minor, major }' $3
+}
+
+mkdir -p $DATA $RESULTS
+check_interpolation
+TSV=$RESULTS/$LABEL.tsv
+printf "size\tconfig\tphase\twall_time\tcpu_time\titems\tbytes\tmax_rss_mb\tminor_faults\tmajor_faults\n" > $TSV
+for size in $SIZES; do
+    model=$DATA/$size
+    if [ ! -f $model.arpa -o ! -f $model.test ]; then
+        ./gen_arpa -t $SENTENCES $(model_counts $size) $model
+    fi
+    if [ ! -f $model-b.arpa ]; then
+        ./gen_arpa -s 4321 $(model_counts $size) $model-b
+    fi
+    declare -A references=()
+    for c in "${CONFIGS[@]}"; do
+        config=${c%%:*}
+        options=${c#*:}
+        group=${config%%-*}
+        output=$DATA/$size-$config.lira
+        $ARPA2LIRA $options -m $DATA/$size-$config.json \
+            $(config_inputs $config $model) $output 2> $DATA/$size-$config.log
+        metrics_to_tsv $size $config $DATA/$size-$config.json >> $TSV
+        reference=${references[$group]:=$output}
+        if ! cmp -s $reference $output; then
+            echo "Output of $config differs from $reference" >&2
+            exit 1
+        fi
+        total=$(awk -F'\t' '$3 == "total" { print $4 "s " $8 "MB" }' \
+            <(metrics_to_tsv $size $config $DATA/$size-$config.json))
+        printf "%-8s %-22s %s\n" $size $config "$total"
+        [ $output = $reference ] || rm -f $output
+    done
+    if ! check_bounds ${references[quant]}; then
+        echo "Wrong bounds in ${references[quant]}" >&2
+        exit 1
+    fi
+    for group in text binary; do
+        reference=${references[$group]}
+        config=query-$group
+        ./lira_query_bench -r 5 -m $DATA/$size-$config.json \
+            $reference $model.test > $DATA/$size-$config.log 2>&1
+        metrics_to_tsv $size $config $DATA/$size-$config.json >> $TSV
+        qps=$(awk '/queries\/s/ { printf "%s %s ", $1, $6 }' \
+            $DATA/$size-$config.log)
+        printf "%-8s %-22s %s\n" $size $config "$qps"
+    done
+    rm -f ${references[@]} $DATA/snapshot
+done
+echo "timings stored in bench/$TSV"
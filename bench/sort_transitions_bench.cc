@@ -0,0 +1,206 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <future>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "april-ann.h"
+
+#include "config.h"
+#include "lm_arrays.h"
+
+using namespace Arpa2Lira;
+
+// array of structures layout used as comparison baseline
+struct Transition {
+  int origin, dest, word;
+  float trans_prob;
+  bool operator<(const Transition &other) const {
+    return ( (origin < other.origin) ||
+             (origin == other.origin && word < other.word) );
+  }
+};
+
+// Parallel and stable LSD radix sort using Config::thread_pool, which sorted
+// the array of structures layout before the column arrays, kept as a
+// comparison point. The key function returns an unsigned 64 bits key with at
+// most key_bits significant bits. Every pass computes per-thread histograms
+// of one digit and scatters the elements of every thread into its own
+// positions of the output. tmp is scratch space for n elements; the sorted
+// data ends in v or tmp, the returned pointer says which.
+template<typename T, typename KeyFn>
+T *parallel_radix_sort(T *v, T *tmp, size_t n, int key_bits, KeyFn key) {
+  const int RADIX_BITS = 8;
+  const size_t RADIX = 1u << RADIX_BITS;
+  const size_t MIN_PART_SIZE = 65536u;
+  size_t num_parts = AprilUtils::min(size_t(Config::getNumberOfThreads()),
+                                     n / MIN_PART_SIZE);
+  if (num_parts < 1u) num_parts = 1u;
+  const size_t part_size = (n + num_parts - 1) / num_parts;
+  std::vector<size_t> offsets(num_parts * RADIX);
+  std::vector< std::future<void> > futures(num_parts);
+  
+  for (int shift=0; shift<key_bits; shift+=RADIX_BITS) {
+    // per part histograms
+    for (size_t p=0; p<num_parts; ++p) {
+      futures[p] = Config::thread_pool->enqueue([&,p]() {
+          size_t *count = &offsets[p * RADIX];
+          for (size_t d=0; d<RADIX; ++d) count[d] = 0u;
+          const size_t end = AprilUtils::min(n, (p+1)*part_size);
+          for (size_t i=p*part_size; i<end; ++i) {
+            ++count[(key(v[i]) >> shift) & (RADIX - 1)];
+          }
+        });
+    }
+    for (size_t p=0; p<num_parts; ++p) futures[p].get();
+    // exclusive prefix sum in (digit, part) order keeps the sort stable
+    size_t sum = 0u;
+    bool trivial = false; // all the keys have the same digit
+    for (size_t d=0; d<RADIX; ++d) {
+      size_t digit_count = 0u;
+      for (size_t p=0; p<num_parts; ++p) {
+        size_t c = offsets[p * RADIX + d];
+        offsets[p * RADIX + d] = sum;
+        sum += c;
+        digit_count += c;
+      }
+      if (digit_count == n) trivial = true;
+    }
+    if (trivial) continue;
+    // scatter
+    for (size_t p=0; p<num_parts; ++p) {
+      futures[p] = Config::thread_pool->enqueue([&,p]() {
+          size_t *offset = &offsets[p * RADIX];
+          const size_t end = AprilUtils::min(n, (p+1)*part_size);
+          for (size_t i=p*part_size; i<end; ++i) {
+            tmp[offset[(key(v[i]) >> shift) & (RADIX - 1)]++] = v[i];
+          }
+        });
+    }
+    for (size_t p=0; p<num_parts; ++p) futures[p].get();
+    std::swap(v, tmp);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s num_transitions num_states num_threads\n",
+            argv[0]);
+    exit(1);
+  }
+  const int num_transitions = atoi(argv[1]);
+  const int num_states      = atoi(argv[2]);
+  Config::setNumberOfThreads(atoi(argv[3]));
+  
+  // as after renaming states, transitions come in runs with the same origin
+  // and increasing words, but origin blocks are unordered
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> origin_dist(0, num_states - 1);
+  std::vector<int> first(num_states + 1, 0);
+  for (int i=0; i<num_transitions; ++i) first[origin_dist(rng) + 1]++;
+  int max_word = 0;
+  for (int o=0; o<num_states; ++o) {
+    max_word = AprilUtils::max(max_word, first[o+1]);
+    first[o+1] += first[o];
+  }
+  std::vector<int> order(num_states);
+  for (int o=0; o<num_states; ++o) order[o] = o;
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<Transition> input;
+  input.reserve(num_transitions);
+  for (int k=0; k<num_states; ++k) {
+    const int o = order[k];
+    for (int w=1; w<=first[o+1]-first[o]; ++w) {
+      Transition t;
+      t.origin     = o;
+      t.dest       = origin_dist(rng);
+      t.word       = w;
+      t.trans_prob = -static_cast<float>(input.size());
+      input.push_back(t);
+    }
+  }
+
+  const int state_bits = bit_width(num_states + 2);
+  const int word_bits  = bit_width(max_word + 1);
+  TransitionArrays columns, sorted;
+  columns.create(num_transitions, state_bits, word_bits);
+  sorted.create(num_transitions, state_bits, word_bits);
+  for (int i=0; i<num_transitions; ++i) {
+    columns.origin.set(i, input[i].origin);
+    columns.dest.set(i, input[i].dest);
+    columns.word.set(i, input[i].word);
+    columns.trans_prob[i] = input[i].trans_prob;
+  }
+
+  typedef std::chrono::steady_clock clock_type;
+  std::vector<Transition> a(input);
+  clock_type::time_point t0 = clock_type::now();
+  AprilUtils::Sort(a.data(), num_transitions);
+  clock_type::time_point t1 = clock_type::now();
+  sort_transitions_by_origin(columns, num_transitions, first.data(),
+                             num_states, sorted);
+  clock_type::time_point t2 = clock_type::now();
+  std::vector<Transition> r(input), tmp(num_transitions);
+  clock_type::time_point t3 = clock_type::now();
+  const Transition *radix_sorted =
+    parallel_radix_sort(r.data(), tmp.data(), num_transitions,
+                        state_bits + word_bits,
+                        [word_bits](const Transition &t) {
+                          const uint64_t origin = t.origin;
+                          return (origin << word_bits) |
+                            static_cast<uint64_t>(t.word);
+                        });
+  clock_type::time_point t4 = clock_type::now();
+
+  for (int i=0; i<num_transitions; ++i) {
+    if (a[i].origin != sorted.origin.get(i) ||
+        a[i].dest != sorted.dest.get(i) ||
+        a[i].word != sorted.word.get(i) ||
+        a[i].trans_prob != sorted.trans_prob[i]) {
+      ERROR_EXIT1(1, "Sort mismatch at position %d\n", i);
+    }
+    if (a[i].origin != radix_sorted[i].origin ||
+        a[i].word != radix_sorted[i].word ||
+        a[i].trans_prob != radix_sorted[i].trans_prob) {
+      ERROR_EXIT1(1, "Radix sort mismatch at position %d\n", i);
+    }
+  }
+  double comparison_time = std::chrono::duration<double>(t1 - t0).count();
+  double bucket_time     = std::chrono::duration<double>(t2 - t1).count();
+  double radix_time      = std::chrono::duration<double>(t4 - t3).count();
+  printf("transitions= %d threads= %u AprilUtils::Sort(AoS %.1f MB)= %.3fs "
+         "parallel_radix_sort(AoS)= %.3fs "
+         "sort_transitions_by_origin(SoA %.1f MB)= %.3fs speedup= %.2f "
+         "speedup_vs_radix= %.2f\n",
+         num_transitions, Config::getNumberOfThreads(),
+         sizeof(Transition)*num_transitions/1048576.0, comparison_time,
+         radix_time, columns.get_bytes()/1048576.0, bucket_time,
+         comparison_time / bucket_time, radix_time / bucket_time);
+  columns.release();
+  sorted.release();
+  return 0;
+}
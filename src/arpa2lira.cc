@@ -1,21 +1,153 @@
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
 #include "binarize_arpa.h"
 #include "config.h"
 
 using namespace Arpa2Lira;
 
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-j num_threads] [-b] [-q 8|16] [-o memory_mb] "
+          "[-t tmpdir] [-l] [-m metrics.json] "
+          "[-H none|thp|hugetlb] [-P none|populate|parallel] "
+          "[-p log10_prob] [-e threshold] [-s snapshot] vocab_filename "
+          "arpa_filename[:weight] [arpa_filename[:weight] ...] lira_filename\n"
+          "       %s [options] -r snapshot lira_filename\n",
+          prog, prog);
+  exit(1);
+}
+
+// Removes the optional :weight suffix of an ARPA argument, 1 by default
+static float split_weight(char *arg) {
+  char *colon = strrchr(arg, ':');
+  if (colon != 0 && colon[1] != '\0') {
+    char *end;
+    float weight = strtof(colon + 1, &end);
+    if (*end == '\0') {
+      if (weight <= 0.0f) {
+        fprintf(stderr, "Interpolation weights must be positive: %s\n", arg);
+        exit(1);
+      }
+      *colon = '\0';
+      return weight;
+    }
+  }
+  return 1.0f;
+}
+
 int main(int argc, char **argv) {
-  if (argc != 4) {
-    fprintf(stderr, "usage: %s vocab_filename arpa_filename lira_filename\n",
-            argv[0]);
-    exit(1);
+  LiraFormat format = LIRA_TEXT;
+  int quant_bits = 0;
+  bool low_memory = false;
+  float prune_prob = -99.0f;
+  double prune_entropy = 0.0;
+  const char *metrics_filename = 0;
+  const char *snapshot_filename = 0;
+  bool resume = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:bq:o:t:lm:H:P:p:e:s:r:")) != -1) {
+    switch (opt) {
+    case 'j':
+      if (atoi(optarg) < 1) usage(argv[0]);
+      Config::setNumberOfThreads(atoi(optarg));
+      break;
+    case 'b':
+      format = LIRA_BINARY;
+      break;
+    case 'q':
+      quant_bits = atoi(optarg);
+      if (quant_bits != 8 && quant_bits != 16) usage(argv[0]);
+      break;
+    case 'o':
+      if (atoi(optarg) < 1) usage(argv[0]);
+      Config::setOutOfCoreMemory(static_cast<size_t>(atoi(optarg)) << 20);
+      break;
+    case 't':
+      Config::setTemporaryDirectory(optarg);
+      break;
+    case 'l':
+      low_memory = true;
+      break;
+    case 'm':
+      metrics_filename = optarg;
+      break;
+    case 'H':
+      if (strcmp(optarg, "none") == 0) {
+        Config::setHugePages(Config::HUGE_PAGES_NONE);
+      }
+      else if (strcmp(optarg, "thp") == 0) {
+        Config::setHugePages(Config::HUGE_PAGES_TRANSPARENT);
+      }
+      else if (strcmp(optarg, "hugetlb") == 0) {
+        Config::setHugePages(Config::HUGE_PAGES_EXPLICIT);
+      }
+      else {
+        usage(argv[0]);
+      }
+      break;
+    case 'P':
+      if (strcmp(optarg, "none") == 0) {
+        Config::setPrefault(Config::PREFAULT_NONE);
+      }
+      else if (strcmp(optarg, "populate") == 0) {
+        Config::setPrefault(Config::PREFAULT_POPULATE);
+      }
+      else if (strcmp(optarg, "parallel") == 0) {
+        Config::setPrefault(Config::PREFAULT_PARALLEL);
+      }
+      else {
+        usage(argv[0]);
+      }
+      break;
+    case 'p':
+      prune_prob = atof(optarg);
+      if (prune_prob >= 0.0f) usage(argv[0]);
+      break;
+    case 'e':
+      prune_entropy = atof(optarg);
+      if (prune_entropy <= 0.0) usage(argv[0]);
+      break;
+    case 's':
+    case 'r':
+      if (snapshot_filename != 0) usage(argv[0]);
+      snapshot_filename = optarg;
+      resume = (opt == 'r');
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (resume ? (argc - optind != 1) : (argc - optind < 3)) {
+    usage(argv[0]);
+  }
+  const char *lira_filename   = argv[argc-1];
+  AprilUtils::UniquePtr<BinarizeArpa> obj;
+  if (resume) {
+    // parsing is skipped, the conversion starts at generate_lira()
+    obj.reset(new BinarizeArpa(snapshot_filename));
+  }
+  else {
+    const char *vocab_filename  = argv[optind];
+    std::vector<const char*> arpa_filenames;
+    std::vector<float> weights;
+    for (int i=optind+1; i<argc-1; ++i) {
+      weights.push_back(split_weight(argv[i]));
+      arpa_filenames.push_back(argv[i]);
+    }
+    obj.reset(new BinarizeArpa(vocab_filename,arpa_filenames,weights));
+  }
+  obj->set_quantization_bits(quant_bits);
+  obj->set_low_memory(low_memory);
+  obj->set_probability_threshold(prune_prob);
+  obj->set_entropy_threshold(prune_entropy);
+  if (!resume) {
+    obj->processArpa();
+    if (snapshot_filename != 0) obj->write_snapshot(snapshot_filename);
+  }
+  obj->generate_lira(lira_filename, format);
+  if (metrics_filename != 0) {
+    obj->get_metrics().write_json(metrics_filename);
   }
-  const char *vocab_filename  = argv[1];
-  const char *arpa_filename   = argv[2];
-  const char *lira_filename   = argv[3];
-  const char *begin_ccue      = "<s>";
-  const char *end_ccue        = "</s>";
-  BinarizeArpa obj(vocab_filename,arpa_filename,begin_ccue,end_ccue);
-  obj.processArpa();
-  obj.generate_lira(lira_filename);
   return 0;
 }
@@ -0,0 +1,312 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <lzma.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+}
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "arpa_input.h"
+
+using namespace AprilUtils;
+
+namespace Arpa2Lira {
+
+  namespace {
+    
+    class GzipDecompressor : public Decompressor {
+      gzFile f;
+    public:
+      GzipDecompressor(const char *filename) {
+        if ((f = gzopen(filename, "rb")) == 0) {
+          ERROR_EXIT2(1, "Unable to open %s: %s\n", filename, strerror(errno));
+        }
+        gzbuffer(f, 1u<<20);
+      }
+      virtual ~GzipDecompressor() {
+        gzclose(f);
+      }
+      virtual size_t read(char *dest, size_t max_size) {
+        int n = gzread(f, dest, AprilUtils::min(max_size, size_t(1u<<30)));
+        if (n < 0) {
+          int errnum;
+          ERROR_EXIT1(1, "Error decompressing gzip input: %s\n",
+                      gzerror(f, &errnum));
+        }
+        return static_cast<size_t>(n);
+      }
+    };
+
+    class XzDecompressor : public Decompressor {
+      static const size_t IN_SIZE = 1u<<20;
+      FILE *f;
+      lzma_stream strm;
+      UniquePtr<uint8_t []> in;
+      bool finished;
+    public:
+      XzDecompressor(const char *filename) : in(new uint8_t[IN_SIZE]),
+                                             finished(false) {
+        if ((f = fopen(filename, "rb")) == 0) {
+          ERROR_EXIT2(1, "Unable to open %s: %s\n", filename, strerror(errno));
+        }
+        memset(&strm, 0, sizeof(strm)); // same as LZMA_STREAM_INIT
+        if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+          ERROR_EXIT(1, "Unable to initialize xz decoder\n");
+        }
+      }
+      virtual ~XzDecompressor() {
+        lzma_end(&strm);
+        fclose(f);
+      }
+      virtual size_t read(char *dest, size_t max_size) {
+        strm.next_out  = (uint8_t*)dest;
+        strm.avail_out = max_size;
+        while (!finished && strm.avail_out > 0) {
+          lzma_action action = LZMA_RUN;
+          if (strm.avail_in == 0) {
+            strm.next_in  = in.get();
+            strm.avail_in = fread(in.get(), 1, IN_SIZE, f);
+          }
+          if (strm.avail_in == 0) action = LZMA_FINISH;
+          lzma_ret ret = lzma_code(&strm, action);
+          if (ret == LZMA_STREAM_END) {
+            finished = true;
+          }
+          else if (ret != LZMA_OK) {
+            ERROR_EXIT1(1, "Error decompressing xz input, code %d\n", (int)ret);
+          }
+        }
+        return max_size - strm.avail_out;
+      }
+    };
+
+#ifdef HAVE_ZSTD
+    class ZstdDecompressor : public Decompressor {
+      FILE *f;
+      ZSTD_DStream *ds;
+      size_t in_size;
+      UniquePtr<char []> in;
+      ZSTD_inBuffer in_buffer;
+      bool input_eof;
+    public:
+      ZstdDecompressor(const char *filename) : in_size(ZSTD_DStreamInSize()),
+                                               in(new char[in_size]),
+                                               input_eof(false) {
+        if ((f = fopen(filename, "rb")) == 0) {
+          ERROR_EXIT2(1, "Unable to open %s: %s\n", filename, strerror(errno));
+        }
+        ds = ZSTD_createDStream();
+        ZSTD_initDStream(ds);
+        in_buffer.src  = in.get();
+        in_buffer.size = 0;
+        in_buffer.pos  = 0;
+      }
+      virtual ~ZstdDecompressor() {
+        ZSTD_freeDStream(ds);
+        fclose(f);
+      }
+      virtual size_t read(char *dest, size_t max_size) {
+        ZSTD_outBuffer out = { dest, max_size, 0 };
+        while (out.pos < out.size) {
+          if (in_buffer.pos == in_buffer.size && !input_eof) {
+            in_buffer.size = fread(in.get(), 1, in_size, f);
+            in_buffer.pos  = 0;
+            if (in_buffer.size == 0) input_eof = true;
+          }
+          size_t prev_pos = out.pos;
+          size_t ret = ZSTD_decompressStream(ds, &out, &in_buffer);
+          if (ZSTD_isError(ret)) {
+            ERROR_EXIT1(1, "Error decompressing zstd input: %s\n",
+                        ZSTD_getErrorName(ret));
+          }
+          // all the input has been given and nothing else is flushed
+          if (input_eof && out.pos == prev_pos) break;
+        }
+        return out.pos;
+      }
+    };
+#endif
+    
+  } // anonymous namespace
+
+  ///////////////////////////////////////////////////////////////////////////
+
+  ArpaInput *ArpaInput::open(const char *filename) {
+    unsigned char magic[6] = { 0 };
+    FILE *f = fopen(filename, "rb");
+    if (f == 0) {
+      ERROR_EXIT2(1, "Unable to open %s: %s\n", filename, strerror(errno));
+    }
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+      return new CompressedArpaInput(new GzipDecompressor(filename));
+    }
+    if (n >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0) {
+      return new CompressedArpaInput(new XzDecompressor(filename));
+    }
+    if (n >= 4 && memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0) {
+#ifdef HAVE_ZSTD
+      return new CompressedArpaInput(new ZstdDecompressor(filename));
+#else
+      ERROR_EXIT1(1, "Unable to read %s, compiled without zstd support\n",
+                  filename);
+#endif
+    }
+    return new MmappedArpaInput(filename);
+  }
+  
+  ///////////////////////////////////////////////////////////////////////////
+
+  MmappedArpaInput::MmappedArpaInput(const char *filename) :
+    acquired(false), discarded(0u) {
+    read_mmapped_buffer(filedata, filename);
+    // the input is read once from the beginning to the end
+    advise_mmapped_buffer(filedata, MADV_SEQUENTIAL);
+    advise_mmapped_buffer(filedata, MADV_WILLNEED);
+  }
+
+  MmappedArpaInput::~MmappedArpaInput() {
+    release_mmapped_buffer(filedata);
+  }
+
+  constString MmappedArpaInput::acquire() {
+    if (acquired) return constString();
+    acquired = true;
+    return constString(filedata.file_mmapped, filedata.file_size);
+  }
+
+  // Pages of the file mapping are dropped from the resident set, they would
+  // be read again from the file if needed
+  void MmappedArpaInput::discard(const char *end) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t limit = ((end - filedata.file_mmapped) / page_size) * page_size;
+    if (limit > discarded) {
+      madvise(filedata.file_mmapped + discarded, limit - discarded,
+              MADV_DONTNEED);
+      discarded = limit;
+    }
+  }
+  
+  ///////////////////////////////////////////////////////////////////////////
+
+  CompressedArpaInput::CompressedArpaInput(Decompressor *decompressor) :
+    decompressor(decompressor),
+    next_write(0), next_acquire(0), num_free(NUM_BLOCKS),
+    end_of_file(false), stop(false) {
+    for (int i=0; i<NUM_BLOCKS; ++i) {
+      blocks[i].data.reset(new char[BLOCK_SIZE]);
+      blocks[i].size  = 0;
+      blocks[i].ready = false;
+    }
+    producer = std::thread(&CompressedArpaInput::produce, this);
+  }
+
+  CompressedArpaInput::~CompressedArpaInput() {
+    {
+      std::unique_lock<std::mutex> lock(ring_mutex);
+      stop = true;
+    }
+    ring_condition.notify_all();
+    producer.join();
+  }
+
+  void CompressedArpaInput::produce() {
+    std::vector<char> carry; // partial last line of the previous block
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(ring_mutex);
+        ring_condition.wait(lock, [this]{ return stop || num_free > 0; });
+        if (stop) return;
+        num_free--;
+      }
+      // blocks are released in FIFO order, so next_write is free
+      Block &b = blocks[next_write];
+      char *data = b.data.get();
+      size_t size = carry.size();
+      memcpy(data, carry.data(), size);
+      carry.clear();
+      bool eof = false;
+      while (size < BLOCK_SIZE) {
+        size_t n = decompressor->read(data + size, BLOCK_SIZE - size);
+        if (n == 0) {
+          eof = true;
+          break;
+        }
+        size += n;
+      }
+      if (!eof) {
+        // the partial last line is moved to the next block
+        char *last = (char*)memrchr(data, '\n', size);
+        if (last == 0) {
+          ERROR_EXIT1(1, "Found a line longer than %lu bytes\n", BLOCK_SIZE);
+        }
+        ++last;
+        carry.assign(last, data + size);
+        size = last - data;
+      }
+      {
+        std::unique_lock<std::mutex> lock(ring_mutex);
+        if (size > 0) {
+          b.size  = size;
+          b.ready = true;
+          next_write = (next_write + 1) % NUM_BLOCKS;
+        }
+        else {
+          num_free++;
+        }
+        end_of_file = eof;
+      }
+      ring_condition.notify_all();
+      if (eof) return;
+    }
+  }
+
+  constString CompressedArpaInput::acquire() {
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    Block &b = blocks[next_acquire];
+    ring_condition.wait(lock, [this,&b]{ return b.ready || end_of_file; });
+    if (!b.ready) return constString(); // end of file
+    b.ready = false;
+    next_acquire = (next_acquire + 1) % NUM_BLOCKS;
+    return constString(b.data.get(), b.size);
+  }
+
+  void CompressedArpaInput::release() {
+    {
+      std::unique_lock<std::mutex> lock(ring_mutex);
+      num_free++;
+    }
+    ring_condition.notify_all();
+  }
+  
+} // namespace Arpa2Lira
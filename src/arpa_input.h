@@ -0,0 +1,115 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef ARPA_INPUT_H
+#define ARPA_INPUT_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "mmapped_file.h"
+
+namespace Arpa2Lira {
+
+  /// Gives access to the ARPA text as a sequence of blocks which always
+  /// contain complete lines. Blocks are acquired and released in FIFO order,
+  /// a block memory is valid until it is released.
+  class ArpaInput {
+  public:
+    virtual ~ArpaInput() { }
+    /// Returns the next block, or an empty string at the end of the input
+    virtual AprilUtils::constString acquire() = 0;
+    /// Releases the oldest acquired block
+    virtual void release() = 0;
+    /// Maximum number of blocks which can be acquired and not released
+    virtual int max_acquired() const = 0;
+    /// Hints that the text of the oldest acquired block before end will not
+    /// be read again, so its memory can be returned to the system
+    virtual void discard(const char *end) { UNUSED_VARIABLE(end); }
+    
+    /// Opens a plain, gzip, xz or zstd (when compiled with HAVE_ZSTD) input,
+    /// the format is detected from the first bytes of the file
+    static ArpaInput *open(const char *filename);
+  };
+
+  /// Plain text input, the whole file is mmapped and returned as one block
+  class MmappedArpaInput : public ArpaInput {
+    mmapped_file_data filedata;
+    bool acquired;
+    size_t discarded; // bytes at the beginning of the file already discarded
+  public:
+    MmappedArpaInput(const char *filename);
+    virtual ~MmappedArpaInput();
+    virtual AprilUtils::constString acquire();
+    virtual void release() { }
+    virtual int max_acquired() const { return 1; }
+    virtual void discard(const char *end);
+  };
+
+  /// Streams a file through a decompression algorithm
+  class Decompressor {
+  public:
+    virtual ~Decompressor() { }
+    /// Returns the number of bytes written to dest, 0 at the end of the file
+    virtual size_t read(char *dest, size_t max_size) = 0;
+  };
+  
+  /// Compressed input, a producer thread decompresses the file into a bounded
+  /// ring of blocks which are consumed by the parser, so decompression and
+  /// parsing overlap without any temporary file.
+  class CompressedArpaInput : public ArpaInput {
+    static const size_t BLOCK_SIZE = 32u<<20;
+    static const int NUM_BLOCKS = 4;
+
+    struct Block {
+      AprilUtils::UniquePtr<char []> data;
+      size_t size;
+      bool ready; // written by the producer and not consumed yet
+    };
+    
+    AprilUtils::UniquePtr<Decompressor> decompressor;
+    Block blocks[NUM_BLOCKS];
+    int next_write;    // next block filled by the producer
+    int next_acquire;  // next block returned by acquire()
+    int num_free;      // blocks available to the producer
+    bool end_of_file;  // producer has finished
+    bool stop;         // destructor asks the producer to finish
+    std::mutex ring_mutex;
+    std::condition_variable ring_condition;
+    std::thread producer;
+
+    void produce();
+    
+  public:
+    CompressedArpaInput(Decompressor *decompressor);
+    virtual ~CompressedArpaInput();
+    virtual AprilUtils::constString acquire();
+    virtual void release();
+    virtual int max_acquired() const { return NUM_BLOCKS; }
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // ARPA_INPUT_H
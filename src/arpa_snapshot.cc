@@ -0,0 +1,85 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "arpa_snapshot.h"
+
+namespace Arpa2Lira {
+
+  namespace {
+    void read_at(int fd, void *dest, size_t size, uint64_t offset,
+                 const char *filename) {
+      char *p = static_cast<char*>(dest);
+      while (size > 0u) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n <= 0) {
+          ERROR_EXIT2(1, "Unable to read snapshot %s: %s\n", filename,
+                      (n == 0) ? "unexpected end of file" : strerror(errno));
+        }
+        p += n;
+        size -= n;
+        offset += n;
+      }
+    }
+  } // anonymous namespace
+
+  ArpaSnapshot::ArpaSnapshot(const char *filename) {
+    if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+      ERROR_EXIT2(1, "Unable to open snapshot %s: %s\n", filename,
+                  strerror(errno));
+    }
+    read_at(fd, &header, sizeof(header), 0u, filename);
+    if (memcmp(header.magic, ARPA_SNAPSHOT_MAGIC,
+               sizeof(ARPA_SNAPSHOT_MAGIC)) != 0) {
+      ERROR_EXIT1(1, "%s is not a snapshot of arpa2lira\n", filename);
+    }
+    if (header.version != ARPA_SNAPSHOT_VERSION) {
+      ERROR_EXIT3(1, "Snapshot %s has version %u, expected %u\n", filename,
+                  header.version, ARPA_SNAPSHOT_VERSION);
+    }
+    if (header.byte_order != ARPA_SNAPSHOT_BYTE_ORDER) {
+      ERROR_EXIT1(1, "Snapshot %s was written with another byte order\n",
+                  filename);
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) != 0 ||
+        static_cast<uint64_t>(statbuf.st_size) != header.file_size) {
+      ERROR_EXIT1(1, "Snapshot %s is truncated\n", filename);
+    }
+    vocab.resize(header.vocab_bytes);
+    read_at(fd, vocab.data(), vocab.size(), header.vocab_offset, filename);
+  }
+
+  ArpaSnapshot::~ArpaSnapshot() {
+    close(fd);
+  }
+
+} // namespace Arpa2Lira
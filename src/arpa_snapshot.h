@@ -0,0 +1,110 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef ARPA_SNAPSHOT_H
+#define ARPA_SNAPSHOT_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace Arpa2Lira {
+
+  /*
+   * Snapshot of a parsed model, written by BinarizeArpa::write_snapshot()
+   * between processArpa() and generate_lira(). Resuming from it skips the
+   * parsing of the ARPA files. Every section starts at an offset multiple
+   * of ARPA_SNAPSHOT_ALIGNMENT, larger than the page size, so the arrays
+   * are mmapped copy-on-write and used in place:
+   *
+   * - ArpaSnapshotHeader
+   * - vocabulary: vocab_size '\0' terminated words, sorted by word id (1..V)
+   * - one section for every ArpaSnapshotArray, num_states elements of the
+   *   state arrays and num_transitions elements of the transition arrays.
+   *   Packed arrays are stored as the 64 bit words of PackedArray, their
+   *   width is given by the header, and float arrays as floats.
+   *
+   * All numbers are stored with the native byte order of the writer machine,
+   * byte_order field allows to detect a mismatch.
+   */
+
+  const char     ARPA_SNAPSHOT_MAGIC[8]  = { 'A','R','P','A','S','N','P','\0' };
+  const uint32_t ARPA_SNAPSHOT_VERSION   = 1u;
+  const uint32_t ARPA_SNAPSHOT_BYTE_ORDER = 0x01020304u;
+  const uint64_t ARPA_SNAPSHOT_ALIGNMENT = 65536u;
+
+  enum ArpaSnapshotArray {
+    SNAPSHOT_FAN_OUT,
+    SNAPSHOT_BACKOFF_DEST,
+    SNAPSHOT_ORDER,
+    SNAPSHOT_BEST_PROB,
+    SNAPSHOT_BACKOFF_WEIGHT,
+    SNAPSHOT_ORIGIN, // transition arrays from here
+    SNAPSHOT_DEST,
+    SNAPSHOT_WORD,
+    SNAPSHOT_TRANS_PROB,
+    SNAPSHOT_NUM_ARRAYS
+  };
+
+  struct ArpaSnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t  vocab_size;
+    int32_t  ngram_order;
+    int32_t  num_states;
+    int32_t  num_transitions;
+    int32_t  initial_state;
+    int32_t  begin_ccue;
+    int32_t  end_ccue;
+    int32_t  widths[SNAPSHOT_NUM_ARRAYS]; // bits of packed arrays, 0 for floats
+    uint64_t vocab_offset;
+    uint64_t vocab_bytes;
+    uint64_t offsets[SNAPSHOT_NUM_ARRAYS];
+    uint64_t file_size;
+  };
+
+  inline uint64_t arpa_snapshot_align(uint64_t offset) {
+    return (offset + ARPA_SNAPSHOT_ALIGNMENT - 1) & ~(ARPA_SNAPSHOT_ALIGNMENT - 1);
+  }
+
+  /// A snapshot opened for resuming, the header is checked and the
+  /// vocabulary read, the arrays are mmapped from the file descriptor
+  class ArpaSnapshot {
+    int fd;
+    ArpaSnapshotHeader header;
+    std::vector<char> vocab;
+
+    ArpaSnapshot(const ArpaSnapshot &);
+    ArpaSnapshot &operator=(const ArpaSnapshot &);
+
+  public:
+    explicit ArpaSnapshot(const char *filename);
+    ~ArpaSnapshot();
+
+    int get_file_descriptor() const { return fd; }
+    const ArpaSnapshotHeader &get_header() const { return header; }
+    /// vocab_size '\0' terminated words, sorted by word id
+    const char *get_vocab() const { return vocab.data(); }
+    size_t get_vocab_bytes() const { return vocab.size(); }
+  };
+
+} // namespace Arpa2Lira
+
+#endif // ARPA_SNAPSHOT_H
@@ -25,8 +25,12 @@ extern "C" {
 #include <unistd.h>
 }
 
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
 #include <cstring>
+#include <deque>
+#include <future>
 
 // from APRIL
 #include "april-ann.h"
@@ -34,6 +38,7 @@ extern "C" {
 // from Arpa2Lira
 #include "binarize_arpa.h"
 #include "config.h"
+#include "parallel_compressor.h"
 
 using namespace AprilUtils;
 using namespace AprilIO;
@@ -50,16 +55,10 @@ namespace Arpa2Lira {
 
   ///////////////////////////////////////////////////////////////////////////
   
+  // Compressed outputs are written as plain files, compression is done by
+  // ParallelCompressor
   StreamInterface *openFile(const char *filename, const char *mode) {
-    size_t len = strlen(filename);
-    StreamInterface *f;
-    if (strcmp(filename + len - 3, ".gz") == 0) {
-      f = new GZFileStream(filename, mode);
-    }
-    else {
-      f = new FileStream(filename, mode);
-    }
-    return f;
+    return new FileStream(filename, mode);
   }
   
   ///////////////////////////////////////////////////////////////////////////
@@ -67,103 +66,217 @@ namespace Arpa2Lira {
   BinarizeArpa::BinarizeArpa(const char *vocabFilename,
                              const char *inputFilename,
                              const char *begin_ccue,
+                             const char *end_ccue) :
+    BinarizeArpa(vocabFilename,
+                 std::vector<const char*>(1, inputFilename),
+                 std::vector<float>(1, 1.0f),
+                 begin_ccue, end_ccue) {
+  }
+
+  BinarizeArpa::BinarizeArpa(const char *vocabFilename,
+                             const std::vector<const char*> &inputFilenames,
+                             const std::vector<float> &weights,
+                             const char *begin_ccue,
                              const char *end_ccue) : 
     voc(vocabFilename),
     ngramOrder(0),
     num_states(2), // 0 and 1 are zerogram_st and final_st
     num_transitions(0),
+    quant_bits(0),
+    low_memory(false),
+    prepared(false),
+    prune_prob(logZero),
+    prune_entropy(0.0),
     begin_ccue(voc(begin_ccue)),
     end_ccue(voc(end_ccue)) {
 
     cod2state = 0;
+    if (this->begin_ccue == VocabDictionary::UNKNOWN_WORD ||
+        this->end_ccue == VocabDictionary::UNKNOWN_WORD) {
+      ERROR_EXIT2(1, "Context cues %s and %s must be in the vocabulary\n",
+                  begin_ccue, end_ccue);
+    }
 
-    read_mmapped_buffer(input_arpa_file,inputFilename);
-    workingInput = inputFile = constString(input_arpa_file.file_mmapped,
-                                           input_arpa_file.file_size);
+    if (inputFilenames.empty() || inputFilenames.size() != weights.size()) {
+      ERROR_EXIT(1, "Every ARPA input needs an interpolation weight\n");
+    }
+    if (inputFilenames.size() > static_cast<size_t>(MAX_SOURCES)) {
+      ERROR_EXIT1(1, "At most %d ARPA inputs can be interpolated\n",
+                  MAX_SOURCES);
+    }
+    double sum = 0.0;
+    for (size_t i=0; i<weights.size(); ++i) {
+      if (!(weights[i] > 0.0f)) {
+        ERROR_EXIT1(1, "Interpolation weights must be positive, found %g\n",
+                    weights[i]);
+      }
+      sum += weights[i];
+    }
+    for (size_t i=0; i<inputFilenames.size(); ++i) {
+      ArpaSource *src = new ArpaSource();
+      src->input = ArpaInput::open(inputFilenames[i]);
+      src->acquired_blocks = 0;
+      src->ngramOrder = 0;
+      src->weight = weights[i] / sum;
+      sources.push_back(src);
+    }
+  }
+  
+  BinarizeArpa::BinarizeArpa(const char *snapshotFilename) :
+    BinarizeArpa(ArpaSnapshot(snapshotFilename)) {
+  }
+
+  // The arrays are mapped from the snapshot with their exact sizes, which
+  // only decrease from now on, and the state codes are computed again
+  BinarizeArpa::BinarizeArpa(const ArpaSnapshot &snapshot) :
+    voc(snapshot.get_vocab(), snapshot.get_vocab_bytes()),
+    ngramOrder(snapshot.get_header().ngram_order),
+    num_states(snapshot.get_header().num_states),
+    num_transitions(snapshot.get_header().num_transitions),
+    quant_bits(0),
+    low_memory(false),
+    prepared(false),
+    prune_prob(logZero),
+    prune_entropy(0.0),
+    begin_ccue(snapshot.get_header().begin_ccue),
+    end_ccue(snapshot.get_header().end_ccue) {
+
+    const ArpaSnapshotHeader &header = snapshot.get_header();
+    cod2state = 0;
+    if (static_cast<int>(voc.get_vocab_size()) != header.vocab_size ||
+        ngramOrder < 1 || ngramOrder > MAX_NGRAM_ORDER) {
+      ERROR_EXIT(1, "Wrong snapshot header\n");
+    }
+    metrics.begin("resume");
+    initial_st = header.initial_state;
+    max_num_states = max_num_ngram_states = num_states;
+    max_num_transitions = num_transitions;
+    PackedArray *packed[SNAPSHOT_NUM_ARRAYS];
+    FloatArray  *floats[SNAPSHOT_NUM_ARRAYS];
+    get_snapshot_arrays(packed, floats);
+    for (int i=0; i<SNAPSHOT_NUM_ARRAYS; ++i) {
+      const size_t n = (i < SNAPSHOT_ORIGIN) ? num_states : num_transitions;
+      if (packed[i] != 0) {
+        packed[i]->map(snapshot.get_file_descriptor(), header.offsets[i], n,
+                       header.widths[i]);
+      }
+      else {
+        floats[i]->map(snapshot.get_file_descriptor(), header.offsets[i], n);
+      }
+    }
+    states.cod.create(num_states, header.widths[SNAPSHOT_BACKOFF_DEST]);
+    metrics.end(num_states + num_transitions, header.file_size);
+    fprintf(stderr,"%d states, %d transitions resumed\n",
+            num_states, num_transitions);
   }
   
   BinarizeArpa::~BinarizeArpa() {
+    for (size_t i=0; i<sources.size(); ++i) {
+      delete sources[i];
+    }
+    states.release();
+    transitions.release();
+    delete[] cod2state;
+  }
+
+  // Makes workingInput non empty, releasing the exhausted blocks and acquiring
+  // the next one, returns false at the end of the input
+  bool BinarizeArpa::fill_input(ArpaSource &src) {
+    while (src.workingInput.len() == 0) {
+      for (; src.acquired_blocks > 0; --src.acquired_blocks) {
+        src.input->release();
+      }
+      src.workingInput = src.input->acquire();
+      if (src.workingInput.len() == 0) {
+        return false;
+      }
+      src.acquired_blocks++;
+    }
+    return true;
+  }
+
+  void BinarizeArpa::release_input(ArpaSource &src) {
+    src.workingInput = constString();
+    for (; src.acquired_blocks > 0; --src.acquired_blocks) {
+      src.input->release();
+    }
+    src.input.reset();
   }
 
-  void BinarizeArpa::processArpaHeader() {
+  void BinarizeArpa::processArpaHeader(ArpaSource &src) {
     int level;
     constString cs,previous;
     do {
-      cs = workingInput.extract_line();
+      if (!fill_input(src)) {
+        ERROR_EXIT(1, "Unable to find \\data\\ section\n");
+      }
+      cs = src.workingInput.extract_line();
     } while (cs != "\\data\\");
-    previous = workingInput;
-    cs = workingInput.extract_line();
+    fill_input(src);
+    previous = src.workingInput;
+    cs = src.workingInput.extract_line();
     while (cs.skip("ngram")) { // example: ngram 1=103459
       assert(cs.extract_int(&level));
-      assert(level == ++ngramOrder);
+      assert(level == ++src.ngramOrder);
+      if (src.ngramOrder > MAX_NGRAM_ORDER) {
+        ERROR_EXIT(1, "Maximum ngram order overflow\n");
+      }
       cs.skip("=");
-      assert(cs.extract_int(&counts[level-1]));
-      previous = workingInput;
-      cs = workingInput.extract_line();
-    }
-    workingInput = previous;
-    if (ngramOrder > MAX_NGRAM_ORDER) {
-      ERROR_EXIT(1, "Maximum ngram order overflow\n");
-    }
-  }
-  
-  void BinarizeArpa::create_mmapped_buffer(mmapped_file_data &filedata,
-                                           size_t filesize) {
-    filedata.file_descriptor = -1;
-    filedata.file_size       = filesize;
-    if ((filedata.file_mmapped = (char*)mmap(NULL, filesize,
-                                             PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED,
-                                             -1, 0)) == MAP_FAILED) {
-      ERROR_EXIT2(1, "Error creating anonymous mmap of size %lu: %s\n",
-                  filesize, strerror(errno));
-    }
-  }
-
-  void BinarizeArpa::read_mmapped_buffer(mmapped_file_data &filedata,
-                                         const char *filename) {
-    // open file
-    filedata.file_descriptor = -1;
-    assert((filedata.file_descriptor = open(filename, O_RDONLY)) >= 0);
-    // find size of input file
-    struct stat statbuf;
-    assert(fstat(filedata.file_descriptor,&statbuf) >= 0);
-    filedata.file_size = statbuf.st_size;
-    // mmap the input file
-    if ((filedata.file_mmapped = (char*)mmap(NULL, filedata.file_size,
-                                             PROT_READ, MAP_SHARED,
-                                             filedata.file_descriptor, 0)) == MAP_FAILED) {
-      ERROR_EXIT2(1, "Error reading mmapped file %s: %s\n",
-                  filename, strerror(errno));
+      assert(cs.extract_int(&src.counts[level-1]));
+      fill_input(src);
+      previous = src.workingInput;
+      cs = src.workingInput.extract_line();
     }
+    src.workingInput = previous;
   }
   
-  void BinarizeArpa::release_mmapped_buffer(mmapped_file_data &filedata) {
-    if (filedata.file_descriptor != -1) {
-      close(filedata.file_descriptor);
-    }
-    if (munmap(filedata.file_mmapped, filedata.file_size) == -1) {
-      ERROR_EXIT(1, "munmap error\n");
-    }
-  }
-
   void BinarizeArpa::create_output_vectors() {
     // determine an upper bound on the number of states and transitions
-    max_num_states = 2;
-    max_num_transitions = 0;
+    int num_ngrams = 0;
     for (int level=0; level<ngramOrder; ++level) {
-      max_num_states += counts[level];
+      num_ngrams += counts[level];
+    }
+    max_num_transitions = num_ngrams;
+    max_num_ngram_states = num_ngrams + 2;
+    if (low_memory) {
+      // states are contexts, so they are mostly n-grams of lower orders,
+      // the state columns grow in case of destinations not found in them
+      max_num_states = 2;
+      for (int level=0; level<ngramOrder-1; ++level) {
+        max_num_states += counts[level];
+      }
+    }
+    else {
+      max_num_states = max_num_ngram_states;
     }
-    max_num_transitions += max_num_states;
     
-    // actually create two vectors in a mmapped buffer
-    create_mmapped_buffer(states_data, sizeof(StateData)*max_num_states);
-    states = (StateData*) states_data.file_mmapped;
-    create_mmapped_buffer(transitions_data, sizeof(TransitionData)*max_num_transitions);
-    transitions = (TransitionData*) transitions_data.file_mmapped;
+    // actually create the state and transition columns, state ids are packed
+    // to represent max_num_states+1 (code of useless states) and -1, word ids
+    // and fan outs to represent the vocabulary size, which every source may
+    // repeat until they are interpolated
+    const int state_bits = bit_width(max_num_ngram_states + 2);
+    const int word_bits  = bit_width(voc.get_vocab_size() + 1);
+    const int fan_out_bits = bit_width((voc.get_vocab_size() + 1) *
+                                       static_cast<uint64_t>(sources.size()));
+    states.create(max_num_states, state_bits, fan_out_bits,
+                  bit_width(MAX_NGRAM_ORDER + 1));
+    transitions.create(max_num_transitions, state_bits, word_bits);
+    if (interpolating()) {
+      transition_sources.resize(max_num_transitions);
+      source_backoffs.resize(sources.size());
+      for (size_t i=0; i<sources.size(); ++i) {
+        source_backoffs[i].assign(max_num_states, logOne);
+      }
+    }
+
+    // presize the state dictionary, states of length n are n-grams of order n
+    for (int level=1; level<ngramOrder; ++level) {
+      ngram_dict.reserve(level, counts[level-1]);
+    }
 
     // initialize zerogram_st and final_st
-    initialize_state(final_st);
-    initialize_state(zerogram_st);
+    initialize_state(final_st, 0);
+    initialize_state(zerogram_st, 0);
   }
 
   bool BinarizeArpa::exists_state(int *v, int n, int &st) {
@@ -174,14 +287,28 @@ namespace Arpa2Lira {
       st = final_st;
       return true;
     }
-    return ngram_dict.get((const char*)v,sizeof(int)*n,st);
+    return ngram_dict.get(v,n,st);
   }
 
-  void BinarizeArpa::initialize_state(int st) {
-    states[st].fan_out = 0;
-    states[st].backoff_dest = no_backoff;
-    states[st].best_prob = logZero;
-    states[st].backoff_weight = logZero;
+  void BinarizeArpa::initialize_state(int st, int order) {
+    states.fan_out.set(st, 0);
+    states.order.set(st, order);
+    states.backoff_dest.set(st, no_backoff);
+    states.best_prob[st] = logZero;
+    states.backoff_weight[st] = logZero;
+  }
+
+  // Enlarges the state columns by 1/8, up to the bound given by the header
+  void BinarizeArpa::grow_states() {
+    if (max_num_states >= max_num_ngram_states) {
+      ERROR_EXIT(1, "Max num states exceeded\n");
+    }
+    max_num_states = AprilUtils::min(max_num_ngram_states,
+                                     max_num_states + max_num_states/8 + 1024);
+    states.resize(max_num_states);
+    for (size_t i=0; i<source_backoffs.size(); ++i) {
+      source_backoffs[i].resize(max_num_states, logOne);
+    }
   }
 
   int BinarizeArpa::get_state(int *v, int n) {
@@ -190,27 +317,69 @@ namespace Arpa2Lira {
       st = zerogram_st;
     else if (v[n-1] == end_ccue)
       st = final_st;
-    else if (!ngram_dict.get((const char*)v,sizeof(int)*n,st)) {
+    else if (!ngram_dict.get(v,n,st)) {
+      if (num_states == max_num_states) grow_states();
       st = num_states++;
-      assert(num_states <= max_num_states && " max num states exceeded\n");
-      initialize_state(st);
-      ngram_dict.set((const char*)v,sizeof(int)*n,st);
+      initialize_state(st, n);
+      ngram_dict.set(v,n,st);
     }
     return st;
   }
 
-  void BinarizeArpa::skip_ngram_header(int level) {
+  void BinarizeArpa::skip_ngram_header(ArpaSource &src, int level) {
     char header[20];
     sprintf(header,"\\%d-grams:",level);
     constString cs;
     do {
-      cs = workingInput.extract_line();
+      if (!fill_input(src)) {
+        ERROR_EXIT1(1, "Unable to find %s section\n", header);
+      }
+      cs = src.workingInput.extract_line();
       fprintf(stderr,"%s reading %s\n", header,
               AprilUtils::UniquePtr<char []>(cs.newString()).get());
     } while (!cs.is_prefix(header));
   }
 
-  void BinarizeArpa::extractNgramLevel(int level) {
+  NgramChunk
+  BinarizeArpa::parse_ngram_chunk(constString cs, int level) const {
+    bool notLastLevel = level<ngramOrder;
+    NgramChunk chunk;
+    chunk.num_ngrams = 0;
+    while (cs.len() > 0) {
+      constString line = cs.extract_line();
+      if (line.len() == 0 || line[0] == '\r') continue; // empty line
+      float trans=logZero,bo=logZero;
+      line.extract_float(&trans);
+      trans = arpa_prob(trans);
+      line.skip(1);
+      for (int j=0; j<level; ++j) {
+        constString word = line.extract_token("\t ");
+        line.skip(1);
+        unsigned int id = voc(word);
+        if (id == VocabDictionary::UNKNOWN_WORD && chunk.unknown_word.len() == 0) {
+          chunk.unknown_word = word;
+        }
+        chunk.words.push_back(id);
+      }
+      if (notLastLevel) {
+        if (line.extract_float(&bo)) {
+          bo = arpa_prob(bo);
+        } else {
+          bo = logOne;
+        }
+      }
+      chunk.probs.push_back(trans);
+      chunk.probs.push_back(bo);
+      chunk.num_ngrams++;
+    }
+    return chunk;
+  }
+
+  // When interpolating, every source keeps its own backoff weight of the
+  // state, and a backoff destination is needed even if the backoff weight
+  // of the first source is zero, as other sources may use it
+  void BinarizeArpa::process_ngram(int source, int level, int *ngram,
+                                   float trans, float bo) {
     bool notLastLevel = level<ngramOrder;
     int from = 1; // this is true for the last ngram level:
     if (notLastLevel) {
@@ -220,264 +389,1423 @@ namespace Arpa2Lira {
     int backoff_search_start = from+1;
     int backoff_size = level-backoff_search_start;
 
-    skip_ngram_header(level);
-    int numNgrams = counts[level-1];
+    int orig_state,dest_state,backoff_dest_state;
 
-    for (int i=0; i<numNgrams; ++i) {
-      if (i>0 && i%10000==0) {
-        fprintf(stderr,"\r%6.2f%%",i*100.0f/numNgrams);
-      }
-      constString cs = workingInput.extract_line();
-      float trans,bo;
-      cs.extract_float(&trans);
-      trans = arpa_prob(trans);
-      cs.skip(1);
-      for (int j=0; j<level; ++j) {
-        constString word = cs.extract_token("\t ");
-        cs.skip(1);
-        int wordId = voc(word);
-        ngramvec[j] = wordId;
+    orig_state = get_state(ngram,level-1);
+    assert(orig_state != final_st);
+    dest_state = get_state(ngram+from,dest_size);
+
+    if (dest_state != final_st &&
+        states.backoff_dest.get(dest_state) == no_backoff &&
+        (bo > logZero || interpolating())) {
+      // look for backoff_dest_state
+      backoff_dest_state = zerogram_st;
+      int search_start = backoff_search_start;
+      int search_size  = backoff_size;
+      while (search_size>0 &&
+             !exists_state(ngram+search_start,search_size,backoff_dest_state)) {
+        search_start++;
+        search_size--;
       }
-      if (notLastLevel) {
-        if (cs.extract_float(&bo)) {
-          bo = arpa_prob(bo);
-        } else {
-          bo = logOne;
+      states.backoff_dest.set(dest_state, backoff_dest_state);
+      states.backoff_weight[dest_state] = bo;
+    }
+    if (interpolating() && notLastLevel && dest_state != final_st) {
+      source_backoffs[source][dest_state] = bo;
+    }
+
+    if (states.best_prob[orig_state] < trans)
+      states.best_prob[orig_state] = trans;
+
+    assert(num_transitions < max_num_transitions && " max num transitions exceeded\n");
+    states.fan_out.set(orig_state, states.fan_out.get(orig_state) + 1);
+    transitions.origin.set(num_transitions, orig_state);
+    transitions.dest.set(num_transitions, dest_state);
+    transitions.word.set(num_transitions, ngram[level-1]);
+    transitions.trans_prob[num_transitions] = trans;
+    if (interpolating()) transition_sources[num_transitions] = source;
+    num_transitions++;
+  }
+
+  // The n-gram section is split in newline-aligned chunks which are tokenized
+  // and parsed concurrently by the thread pool. Parsed chunks are consumed in
+  // order by this thread, so states and transitions are numbered exactly as in
+  // a sequential traversal of the file. Input blocks are released once all
+  // their chunks have been consumed. When interpolating, the sections of all
+  // the sources are traversed one after another by the same pipeline, so the
+  // next source is being parsed while the tail of the previous one is
+  // consumed.
+  uint64_t BinarizeArpa::extractNgramLevel(int level) {
+    uint64_t num_bytes = 0u;
+    std::deque<PendingChunk> pending;
+    const size_t max_pending = 2*Config::getNumberOfThreads() + 1;
+    std::vector<int> found(sources.size(), 0);
+    int total = 0;
+    size_t next = 0;        // source whose section is being split
+    bool in_section = false; // its header has been skipped
+    while (true) {
+      // keep the thread pool busy with the next chunks
+      while (pending.size() < max_pending) {
+        if (!in_section) {
+          while (next < sources.size() && sources[next]->ngramOrder < level) {
+            ++next;
+          }
+          if (next == sources.size()) break;
+          skip_ngram_header(*sources[next], level);
+          in_section = true;
         }
-      }
-      // process current ngram
-      int orig_state,dest_state,backoff_dest_state;
-
-      orig_state = get_state(ngramvec,level-1);
-      assert(orig_state != final_st);
-      dest_state = get_state(ngramvec+from,dest_size);
-
-      if (dest_state != final_st &&
-          states[dest_state].backoff_dest == no_backoff &&
-          bo > logZero) {
-        // look for backoff_dest_state
-        backoff_dest_state = zerogram_st;
-        int search_start = backoff_search_start;
-        int search_size  = backoff_size;
-        while (search_size>0 &&
-               !exists_state(ngramvec+search_start,search_size,backoff_dest_state)) {
-          search_start++;
-          search_size--;
+        ArpaSource &src = *sources[next];
+        if (src.workingInput.len() == 0) {
+          if (src.acquired_blocks >= src.input->max_acquired()) {
+            break; // wait until previous blocks are released
+          }
+          src.workingInput = src.input->acquire();
+          if (src.workingInput.len() == 0) {
+            in_section = false;
+            ++next;
+            continue;
+          }
+          src.acquired_blocks++;
+        }
+        const char *begin = src.workingInput;
+        const char *block_end = begin + src.workingInput.len();
+        if (*begin == '\\') { // next header or \end\ mark
+          in_section = false;
+          ++next;
+          continue;
+        }
+        const char *end = begin + NGRAM_CHUNK_SIZE;
+        if (end >= block_end) {
+          end = block_end;
+        }
+        else {
+          end = (const char*)memchr(end, '\n', block_end - end);
+          end = (end == 0) ? block_end : end + 1;
+        }
+        const char *section_end = (const char*)memmem(begin, end - begin,
+                                                      "\n\\", 2);
+        if (section_end != 0) {
+          end = section_end + 1;
+        }
+        constString cs(begin, end - begin);
+        num_bytes += end - begin;
+        PendingChunk p;
+        p.chunk = Config::thread_pool->enqueue([this, cs, level]() {
+            return parse_ngram_chunk(cs, level);
+          });
+        p.end = end;
+        p.source = next;
+        p.release_block = false;
+        pending.push_back(std::move(p));
+        src.workingInput = constString(end, block_end - end);
+        if (src.workingInput.len() == 0) {
+          PendingChunk mark;
+          mark.end = end;
+          mark.source = next;
+          mark.release_block = true;
+          pending.push_back(std::move(mark));
+        }
+        if (section_end != 0) {
+          in_section = false;
+          ++next;
         }
-        states[dest_state].backoff_dest = backoff_dest_state;
-        states[dest_state].backoff_weight = bo;
       }
-
-      if (states[orig_state].best_prob < trans)
-        states[orig_state].best_prob = trans;
-      
-      assert(num_transitions < max_num_transitions && " max num transitions exceeded\n");
-      states[orig_state].fan_out++;
-      transitions[num_transitions].origin     = orig_state;
-      transitions[num_transitions].dest       = dest_state;
-      transitions[num_transitions].word       = ngramvec[level-1];
-      transitions[num_transitions].trans_prob = trans;
-      num_transitions++;
+      if (pending.empty()) break;
+      PendingChunk p = std::move(pending.front());
+      pending.pop_front();
+      ArpaSource &src = *sources[p.source];
+      if (p.release_block) {
+        src.input->release();
+        src.acquired_blocks--;
+        continue;
+      }
+      NgramChunk chunk = p.chunk.get();
+      if (chunk.unknown_word.len() > 0) {
+        ERROR_EXIT2(1, "Word %.*s not found in the vocabulary\n",
+                    (int)chunk.unknown_word.len(),
+                    (const char*)chunk.unknown_word);
+      }
+      // n-grams beyond the count of the header are ignored
+      int &i = found[p.source];
+      for (int k=0; k<chunk.num_ngrams && i<src.counts[level-1]; ++k, ++i) {
+        process_ngram(p.source, level, chunk.words.data() + k*level,
+                      chunk.probs[2*k], chunk.probs[2*k+1]);
+        ++total;
+      }
+      // the text of consumed chunks is not needed anymore
+      if (low_memory) src.input->discard(p.end);
+      fprintf(stderr,"\r%6.2f%%",total*100.0f/counts[level-1]);
+    }
+    for (size_t s=0; s<sources.size(); ++s) {
+      if (sources[s]->ngramOrder >= level &&
+          found[s] < sources[s]->counts[level-1]) {
+        ERROR_EXIT3(1, "Found %d %d-grams, expected %d\n",
+                    found[s], level, sources[s]->counts[level-1]);
+      }
     }
     fprintf(stderr, "\r100.00%%\n");
+    return num_bytes;
   }
 
+  // The bound of a state is the best of its transitions and the transitions
+  // of its backoff chain plus the accumulated backoff weights. Backoff states
+  // have shorter contexts, so states are processed by waves of decreasing
+  // order: a wave only reads states of lower orders, which still keep their
+  // original best_prob, and its states are bounded in parallel. Backoff
+  // weights are accumulated from the state downwards, as memoizing the bound
+  // of the backoff state would round the sums in a different order.
   void BinarizeArpa::compute_best_prob() {
-    max_bound = logZero; // global
-    for (int st=num_states-1; st>final_st; --st) {
-      if (!is_useless_state(st)) {
-        int   downst = st;
-        float bound  = states[downst].best_prob;
-        float backoffsum = 0;
-        while (downst != zerogram_st &&
-               states[downst].backoff_dest != no_backoff) {
-          backoffsum += states[downst].backoff_weight;
-          downst = states[downst].backoff_dest;
-          float aux = backoffsum + states[downst].best_prob;
-          if (aux > bound)
-            bound = aux;
-        }
-        if (states[st].best_prob < bound)
-          states[st].best_prob = bound;
-        if (bound > max_bound)
-          max_bound = bound;
-      }
+    const size_t GRAIN = 65536u;
+    for (int order=ngramOrder; order>=0; --order) {
+      Config::thread_pool->parallel_for(zerogram_st, num_states, GRAIN,
+                                        [this, order](size_t begin, size_t end) {
+          for (size_t st=begin; st<end; ++st) {
+            if (static_cast<int>(states.order.get(st)) == order &&
+                !is_useless_state(st)) {
+              int   downst = st;
+              float bound  = states.best_prob[downst];
+              float backoffsum = 0;
+              int   backoff;
+              while (downst != zerogram_st &&
+                     (backoff = states.backoff_dest.get(downst)) != no_backoff) {
+                backoffsum += states.backoff_weight[downst];
+                downst = backoff;
+                float aux = backoffsum + states.best_prob[downst];
+                if (aux > bound)
+                  bound = aux;
+              }
+              states.best_prob[st] = bound;
+            }
+          }
+        });
     }
+    // global
+    max_bound = Config::thread_pool->parallel_reduce(zerogram_st, num_states,
+                                                     GRAIN, logZero,
+                                                     [this](size_t begin, size_t end) {
+        float bound = logZero;
+        for (size_t st=begin; st<end; ++st) {
+          if (!is_useless_state(st) && states.best_prob[st] > bound)
+            bound = states.best_prob[st];
+        }
+        return bound;
+      },
+      [](float a, float b) { return AprilUtils::max(a, b); });
   }
 
-  void BinarizeArpa::add_fan_out(int f) {
-    int2int_dict_type::iterator it = fan_out_dict.find(f);
-    if (it == fan_out_dict.end())
-      fan_out_dict[f]=1;
+  // Chunk size of the parallel passes over states and transitions, a few
+  // chunks per thread, multiple of 64 so packed words are not shared
+  static size_t parallel_grain(size_t n) {
+    const size_t MIN_GRAIN = 65536u;
+    const size_t chunks = 4u * Config::getNumberOfThreads();
+    return AprilUtils::max(MIN_GRAIN, ((n + chunks - 1u) / chunks + 63u) &
+                           ~size_t(63u));
+  }
+
+  void BinarizeArpa::add_fan_out(int2int_dict_type &dict, int f, int count) {
+    int2int_dict_type::iterator it = dict.find(f);
+    if (it == dict.end())
+      dict[f]=count;
     else
-      it->second++;
+      it->second += count;
   }
   
+  // Useful states only backoff to useful states after this pass, useless ones
+  // are not modified, so states are processed in parallel. Every chunk counts
+  // its fan outs, and the chunk histograms are merged in order.
   void BinarizeArpa::bypass_backoff_useless_states_and_compute_fanout() {
-    add_fan_out(states[final_st].fan_out);
-    num_useful_states = num_states;
-    for (int st=final_st+1; st<num_states; ++st) {
-      if (is_useless_state(st)) {
-        num_useful_states--;
-      } else {
-        add_fan_out(states[st].fan_out); // put here to avoid a novel traversal :S
-        while (states[st].backoff_dest != no_backoff &&
-               is_useless_state(states[st].backoff_dest)) {
-          int back = states[st].backoff_dest;
-          states[st].backoff_weight += states[back].backoff_weight;
-          states[st].backoff_dest = states[back].backoff_dest;
+    const size_t grain = parallel_grain(num_states);
+    std::vector<int2int_dict_type> chunk_fan_outs((num_states + grain - 1u) / grain);
+    num_useful_states =
+      Config::thread_pool->parallel_reduce(0u, num_states, grain, 0,
+                                           [&](size_t begin, size_t end) {
+        int2int_dict_type &dict = chunk_fan_outs[begin / grain];
+        int useful = 0;
+        for (size_t st=begin; st<end; ++st) {
+          if (is_useless_state(st)) continue;
+          useful++;
+          add_fan_out(dict, states.fan_out.get(st)); // put here to avoid a novel traversal :S
+          int back = states.backoff_dest.get(st);
+          if (back != no_backoff && is_useless_state(back)) {
+            float weight = states.backoff_weight[st];
+            do {
+              weight += states.backoff_weight[back];
+              back = states.backoff_dest.get(back);
+            } while (back != no_backoff && is_useless_state(back));
+            states.backoff_weight[st] = weight;
+            states.backoff_dest.set(st, back);
+          }
         }
+        return useful;
+      },
+      [](int a, int b) { return a + b; });
+    for (size_t i=0; i<chunk_fan_outs.size(); ++i) {
+      for (int2int_dict_type::iterator it = chunk_fan_outs[i].begin();
+           it != chunk_fan_outs[i].end();
+           ++it) {
+        add_fan_out(fan_out_dict, it->first, it->second);
       }
     }
   }
   
   void BinarizeArpa::bypass_destination_useless_states() {
-    num_useful_transitions = 0;
+    num_useful_transitions =
+      Config::thread_pool->parallel_reduce(0u, num_transitions,
+                                           parallel_grain(num_transitions), 0,
+                                           [this](size_t begin, size_t end) {
+        int useful = 0;
+        for (size_t trans=begin; trans<end; ++trans) {
+          if (!is_useless_state(transitions.origin.get(trans))) {
+            useful++;
+            int dest = transitions.dest.get(trans);
+            if (is_useless_state(dest)) {
+              float prob = transitions.trans_prob[trans];
+              do {
+                prob += states.backoff_weight[dest];
+                dest = states.backoff_dest.get(dest);
+              } while (is_useless_state(dest));
+              transitions.trans_prob[trans] = prob;
+              transitions.dest.set(trans, dest);
+            }
+          }
+        }
+        return useful;
+      },
+      [](int a, int b) { return a + b; });
+  }
+  
+  void BinarizeArpa::set_quantization_bits(int bits) {
+    if (bits != 0 && bits != 8 && bits != 16) {
+      ERROR_EXIT1(1, "Quantization bits must be 8 or 16, found %d\n", bits);
+    }
+    quant_bits = bits;
+  }
+
+  void BinarizeArpa::set_low_memory(bool enabled) {
+    low_memory = enabled;
+  }
+
+  void BinarizeArpa::set_probability_threshold(float log10_prob) {
+    prune_prob = arpa_prob(log10_prob);
+  }
+
+  void BinarizeArpa::set_entropy_threshold(double threshold) {
+    if (threshold < 0.0) {
+      ERROR_EXIT1(1, "The entropy threshold must be positive, found %g\n",
+                  threshold);
+    }
+    prune_entropy = threshold;
+  }
+
+  /// Transitions sorted by origin and word, and the pruning or interpolation
+  /// decisions
+  struct TransitionIndex {
+    std::vector<int> first;     // num_states+1, block of every origin
+    std::vector<int> index;     // transitions sorted by origin and word
+    std::vector<char> keep;     // indexed by transition
+    std::vector<int> remaining; // kept transitions of every state
+    std::vector<char> status;   // what happened to every state
+
+    enum {
+      UNCHANGED,
+      CHANGED,  // lost transitions, or its backoff chain did
+      REMOVED   // its n-gram was pruned, it is not a context anymore
+    };
+  };
+
+  // Transitions are placed in the block of their origin and every block is
+  // sorted by word, as sort_transitions() does with renamed states. When
+  // interpolating, transitions of the same word are sorted by source.
+  void BinarizeArpa::build_transition_index(TransitionIndex &index) const {
+    index.first.resize(num_states + 1);
+    index.first[0] = 0;
+    for (int st=0; st<num_states; ++st) {
+      index.first[st+1] = index.first[st] + states.fan_out.get(st);
+    }
+    assert(index.first[num_states] == num_transitions);
+    index.index.resize(num_transitions);
+    std::vector<int> pos(index.first.begin(), index.first.end() - 1);
     for (int trans=0; trans<num_transitions; ++trans) {
-      if (!is_useless_state(transitions[trans].origin)) {
-        num_useful_transitions++;
-        while (is_useless_state(transitions[trans].dest)) {
-          transitions[trans].trans_prob += states[transitions[trans].dest].backoff_weight;
-          transitions[trans].dest = states[transitions[trans].dest].backoff_dest;
+      index.index[pos[transitions.origin.get(trans)]++] = trans;
+    }
+    Config::thread_pool->parallel_for(0u, num_states, 65536u,
+                                      [this, &index](size_t begin, size_t end) {
+        for (size_t st=begin; st<end; ++st) {
+          std::sort(index.index.begin() + index.first[st],
+                    index.index.begin() + index.first[st+1],
+                    [this](int a, int b) {
+                      const unsigned int wa = transitions.word.get(a);
+                      const unsigned int wb = transitions.word.get(b);
+                      if (wa != wb || transition_sources.empty()) return wa < wb;
+                      return transition_sources[a] < transition_sources[b];
+                    });
         }
+      });
+    index.keep.assign(num_transitions, 1);
+    index.remaining.resize(num_states);
+    for (int st=0; st<num_states; ++st) {
+      index.remaining[st] = states.fan_out.get(st);
+    }
+    index.status.assign(num_states, TransitionIndex::UNCHANGED);
+  }
+
+  int BinarizeArpa::find_kept_transition(const TransitionIndex &index,
+                                         int st, int word) const {
+    int begin = index.first[st], end = index.first[st+1];
+    while (begin < end) {
+      const int middle = begin + ((end - begin) >> 1);
+      if (transitions.word.get(index.index[middle]) < word) begin = middle + 1;
+      else end = middle;
+    }
+    if (begin < index.first[st+1]) {
+      const int trans = index.index[begin];
+      if (transitions.word.get(trans) == word && index.keep[trans]) {
+        return trans;
       }
     }
+    return -1;
   }
-  
+
+  // Log probability of word after state st following its backoff chain
+  float BinarizeArpa::backoff_prob(const TransitionIndex &index,
+                                   int st, int word) const {
+    float weight = logOne;
+    while (st != no_backoff) {
+      const int trans = find_kept_transition(index, st, word);
+      if (trans >= 0) return weight + transitions.trans_prob[trans];
+      weight += states.backoff_weight[st];
+      st = states.backoff_dest.get(st);
+    }
+    return logZero;
+  }
+
+  // The log probability of a context is the sum of the transitions which
+  // spell it, those whose destination is one order longer than their
+  // origin. Transitions are stored by increasing order, so origins are
+  // computed before their destinations. Contexts starting by begin_ccue
+  // are not scored from the zerogram.
+  void BinarizeArpa::compute_context_probs(std::vector<float> &context_prob) const {
+    context_prob.assign(num_states, logZero);
+    context_prob[zerogram_st] = logOne;
+    for (int trans=0; trans<num_transitions; ++trans) {
+      const int origin = transitions.origin.get(trans);
+      const int dest   = transitions.dest.get(trans);
+      if (dest != final_st &&
+          states.order.get(dest) == states.order.get(origin) + 1) {
+        context_prob[dest] = (dest == initial_st) ? logOne :
+          context_prob[origin] + transitions.trans_prob[trans];
+      }
+    }
+  }
+
+  // Decides which transitions of st are pruned. Transitions which lead to a
+  // context with transitions are kept, so states are visited by decreasing
+  // order. The relative entropy of removing every n-gram is computed as in
+  // Stolcke (1998), with the backoff weight it would have if it were the
+  // only n-gram removed from its context.
+  void BinarizeArpa::decide_pruning(TransitionIndex &index, int st,
+                                    const std::vector<float> &context_prob,
+                                    std::vector<double> &lower_probs) const {
+    const int begin = index.first[st], end = index.first[st+1];
+    const int back  = states.backoff_dest.get(st);
+    const int order = states.order.get(st);
+    if (begin == end || back == no_backoff) return;
+    double numerator = 1.0, denominator = 1.0;
+    lower_probs.resize(end - begin);
+    for (int i=begin; i<end; ++i) {
+      const int trans = index.index[i];
+      lower_probs[i-begin] = exp(backoff_prob(index, back,
+                                              transitions.word.get(trans)));
+      numerator   -= exp(transitions.trans_prob[trans]);
+      denominator -= lower_probs[i-begin];
+    }
+    const bool use_entropy = prune_entropy > 0.0 &&
+      numerator > 0.0 && denominator > 0.0;
+    const double log_bow = use_entropy ? log(numerator / denominator) : 0.0;
+    const double context = use_entropy ? exp(context_prob[st]) : 0.0;
+    int remaining = end - begin;
+    for (int i=begin; i<end; ++i) {
+      const int trans = index.index[i];
+      const int dest  = transitions.dest.get(trans);
+      if (dest != final_st && states.order.get(dest) == order + 1 &&
+          index.remaining[dest] > 0) {
+        continue;
+      }
+      const double logprob = transitions.trans_prob[trans];
+      bool prune = logprob < prune_prob;
+      if (!prune && use_entropy) {
+        const double prob  = exp(logprob);
+        const double lower = lower_probs[i-begin];
+        const double new_log_bow = log((numerator + prob) / (denominator + lower));
+        const double delta = -context *
+          (prob * (log(lower) + new_log_bow - logprob) +
+           numerator * (new_log_bow - log_bow));
+        prune = expm1(delta) < prune_entropy;
+      }
+      if (prune) {
+        index.keep[trans] = 0;
+        --remaining;
+        if (dest != final_st && states.order.get(dest) == order + 1) {
+          index.status[dest] = TransitionIndex::REMOVED;
+        }
+      }
+    }
+    index.remaining[st] = remaining;
+    if (remaining < end - begin) index.status[st] = TransitionIndex::CHANGED;
+  }
+
+  // The backoff weight makes the probabilities of the context add to one,
+  // given the kept transitions of the state and of its backoff chain
+  void BinarizeArpa::renormalize_backoff(const TransitionIndex &index, int st) {
+    const int back = states.backoff_dest.get(st);
+    double numerator = 1.0, denominator = 1.0;
+    for (int i=index.first[st]; i<index.first[st+1]; ++i) {
+      const int trans = index.index[i];
+      if (!index.keep[trans]) continue;
+      numerator   -= exp(transitions.trans_prob[trans]);
+      denominator -= exp(backoff_prob(index, back, transitions.word.get(trans)));
+    }
+    if (numerator > 0.0 && denominator > 0.0) {
+      states.backoff_weight[st] = log(numerator / denominator);
+    }
+  }
+
+  // Kept transitions are moved down in their original order, fan outs and
+  // the best probability of every state are updated
+  void BinarizeArpa::remove_pruned_transitions(const TransitionIndex &index) {
+    for (int st=0; st<num_states; ++st) {
+      states.fan_out.set(st, index.remaining[st]);
+      states.best_prob[st] = logZero;
+    }
+    int n = 0;
+    for (int trans=0; trans<num_transitions; ++trans) {
+      if (!index.keep[trans]) continue;
+      const int origin = transitions.origin.get(trans);
+      const float prob = transitions.trans_prob[trans];
+      if (n != trans) {
+        transitions.origin.set(n, origin);
+        transitions.dest.set(n, transitions.dest.get(trans));
+        transitions.word.set(n, transitions.word.get(trans));
+        transitions.trans_prob[n] = prob;
+      }
+      if (states.best_prob[origin] < prob) states.best_prob[origin] = prob;
+      ++n;
+    }
+    num_transitions = n;
+  }
+
+  // Pruning decisions of an order only read lower orders, which are not
+  // modified until then, and the decisions of the higher ones, so states
+  // of every order are decided in parallel from the highest order down.
+  // Afterwards backoff weights of the states which lost transitions, or
+  // whose backoff chain did, are recomputed from the lowest order up, and
+  // contexts whose n-gram was pruned do not add any weight, as the ARPA
+  // backoff of a missing context. States left without transitions are
+  // removed by the useless state bypass.
+  void BinarizeArpa::prune_transitions() {
+    TransitionIndex index;
+    build_transition_index(index);
+    std::vector<float> context_prob;
+    if (prune_entropy > 0.0) compute_context_probs(context_prob);
+    const size_t GRAIN = 65536u;
+    for (int order=ngramOrder-1; order>=1; --order) {
+      Config::thread_pool->parallel_for(0u, num_states, GRAIN,
+                                        [&, order](size_t begin, size_t end) {
+          std::vector<double> lower_probs;
+          for (size_t st=begin; st<end; ++st) {
+            if (states.order.get(st) == order) {
+              decide_pruning(index, st, context_prob, lower_probs);
+            }
+          }
+        });
+    }
+    for (int order=1; order<ngramOrder; ++order) {
+      Config::thread_pool->parallel_for(0u, num_states, GRAIN,
+                                        [&, order](size_t begin, size_t end) {
+          for (size_t st=begin; st<end; ++st) {
+            if (st == final_st || states.order.get(st) != order) continue;
+            if (index.status[st] == TransitionIndex::REMOVED) {
+              states.backoff_weight[st] = logOne;
+              continue;
+            }
+            const int back = states.backoff_dest.get(st);
+            if (back == no_backoff) continue;
+            if (index.status[back] != TransitionIndex::UNCHANGED) {
+              index.status[st] = TransitionIndex::CHANGED;
+            }
+            if (index.status[st] == TransitionIndex::CHANGED &&
+                index.first[st] < index.first[st+1]) {
+              renormalize_backoff(index, st);
+            }
+          }
+        });
+    }
+    const int before = num_transitions;
+    remove_pruned_transitions(index);
+    fprintf(stderr, "%d of %d transitions pruned\n",
+            before - num_transitions, before);
+  }
+
+  // First transition of the source with the given origin and word, or -1
+  int BinarizeArpa::find_source_transition(const TransitionIndex &index,
+                                           int source, int st,
+                                           int word) const {
+    int begin = index.first[st], end = index.first[st+1];
+    while (begin < end) {
+      const int middle = begin + ((end - begin) >> 1);
+      if (transitions.word.get(index.index[middle]) < word) begin = middle + 1;
+      else end = middle;
+    }
+    for (; begin < index.first[st+1]; ++begin) {
+      const int trans = index.index[begin];
+      if (static_cast<int>(transitions.word.get(trans)) != word) break;
+      if (transition_sources[trans] == source) return trans;
+    }
+    return -1;
+  }
+
+  // Log probability of word after state st in the given source, following
+  // the backoff chain of the union of states with the backoff weights of the
+  // source, which are zero for contexts missing in it
+  float BinarizeArpa::source_prob(const TransitionIndex &index, int source,
+                                  int st, int word) const {
+    float weight = logOne;
+    while (st != no_backoff) {
+      const int trans = find_source_transition(index, source, st, word);
+      if (trans >= 0) return weight + transitions.trans_prob[trans];
+      weight += source_backoffs[source][st];
+      st = states.backoff_dest.get(st);
+    }
+    return logZero;
+  }
+
+  // Every word with transitions from st keeps its first transition, whose
+  // probability is the interpolation of the probabilities of the word in
+  // all the sources. They are written apart, as other states read the
+  // original ones.
+  void BinarizeArpa::interpolate_state(TransitionIndex &index, int st,
+                                       std::vector<float> &merged) const {
+    const int end = index.first[st+1];
+    int remaining = 0;
+    for (int i=index.first[st]; i<end; ) {
+      const int trans = index.index[i];
+      const int word  = transitions.word.get(trans);
+      double prob = 0.0;
+      for (size_t s=0; s<sources.size(); ++s) {
+        prob += sources[s]->weight * exp(source_prob(index, s, st, word));
+      }
+      merged[trans] = (prob > 0.0) ? log(prob) : logZero;
+      ++remaining;
+      for (++i; i<end &&
+             static_cast<int>(transitions.word.get(index.index[i])) == word;
+           ++i) {
+        assert(transitions.dest.get(index.index[i]) ==
+               transitions.dest.get(trans));
+        index.keep[index.index[i]] = 0;
+      }
+    }
+    index.remaining[st] = remaining;
+  }
+
+  // Static linear interpolation: the union of the n-grams of all the sources
+  // gets the interpolated probabilities, and backoff weights are recomputed
+  // to normalize every context, from the lowest order up as pruning does.
+  // Backoff weights start as the interpolation of the source ones, which is
+  // kept for contexts whose mass cannot be normalized.
+  void BinarizeArpa::interpolate_sources() {
+    TransitionIndex index;
+    build_transition_index(index);
+    std::vector<float> merged(num_transitions);
+    const size_t GRAIN = 65536u;
+    Config::thread_pool->parallel_for(0u, num_states, GRAIN,
+                                      [&](size_t begin, size_t end) {
+        for (size_t st=begin; st<end; ++st) {
+          interpolate_state(index, st, merged);
+        }
+      });
+    for (int trans=0; trans<num_transitions; ++trans) {
+      if (index.keep[trans]) transitions.trans_prob[trans] = merged[trans];
+    }
+    for (int st=zerogram_st; st<num_states; ++st) {
+      if (states.backoff_dest.get(st) == no_backoff) continue;
+      double bo = 0.0;
+      for (size_t s=0; s<sources.size(); ++s) {
+        bo += sources[s]->weight * exp(source_backoffs[s][st]);
+      }
+      states.backoff_weight[st] = (bo > 0.0) ? log(bo) : logZero;
+    }
+    for (int order=1; order<ngramOrder; ++order) {
+      Config::thread_pool->parallel_for(0u, num_states, GRAIN,
+                                        [&, order](size_t begin, size_t end) {
+          for (size_t st=begin; st<end; ++st) {
+            if (st != final_st && states.order.get(st) == order &&
+                states.backoff_dest.get(st) != no_backoff) {
+              renormalize_backoff(index, st);
+            }
+          }
+        });
+    }
+    const int before = num_transitions;
+    remove_pruned_transitions(index);
+    fprintf(stderr, "%d transitions interpolated into %d\n",
+            before, num_transitions);
+    std::vector<uint8_t>().swap(transition_sources);
+    std::vector< std::vector<float> >().swap(source_backoffs);
+  }
+
+  // Trains one codebook per order for transition probabilities and another
+  // for backoff weights, and replaces every value by its quantized one. The
+  // order of a transition is taken from its origin state. It is done after
+  // bypassing useless states, so the written values are codebook entries, and
+  // bounds are computed again from the quantized values.
+  void BinarizeArpa::quantize_probabilities() {
+    std::vector< std::vector<float> > trans_samples(ngramOrder);
+    std::vector< std::vector<float> > backoff_samples(ngramOrder);
+    for (int trans=0; trans<num_transitions; ++trans) {
+      int orig = transitions.origin.get(trans);
+      if (!is_useless_state(orig)) {
+        trans_samples[states.order.get(orig)].push_back(transitions.trans_prob[trans]);
+      }
+    }
+    for (int st=0; st<num_states; ++st) {
+      if (!is_useless_state(st)) {
+        backoff_samples[states.order.get(st)].push_back(states.backoff_weight[st]);
+      }
+    }
+    trans_codebooks.resize(ngramOrder);
+    backoff_codebooks.resize(ngramOrder);
+    for (int order=0; order<ngramOrder; ++order) {
+      trans_codebooks[order].train(trans_samples[order], quant_bits, logZero);
+      backoff_codebooks[order].train(backoff_samples[order], quant_bits, logZero);
+      std::vector<float>().swap(trans_samples[order]);
+      std::vector<float>().swap(backoff_samples[order]);
+    }
+    
+    std::vector<QuantizationError> trans_error(ngramOrder);
+    std::vector<QuantizationError> backoff_error(ngramOrder);
+    // best_prob already holds the bounds of the unquantized backoff chains,
+    // it is computed again from the quantized transitions
+    for (int st=0; st<num_states; ++st) {
+      if (!is_useless_state(st)) states.best_prob[st] = logZero;
+    }
+    for (int trans=0; trans<num_transitions; ++trans) {
+      int orig = transitions.origin.get(trans);
+      if (!is_useless_state(orig)) {
+        int order = states.order.get(orig);
+        const Codebook &codebook = trans_codebooks[order];
+        float v = transitions.trans_prob[trans];
+        float q = codebook.decode(codebook.encode(v));
+        trans_error[order].add(v, q);
+        transitions.trans_prob[trans] = q;
+        if (states.best_prob[orig] < q)
+          states.best_prob[orig] = q;
+      }
+    }
+    for (int st=0; st<num_states; ++st) {
+      if (!is_useless_state(st)) {
+        int order = states.order.get(st);
+        const Codebook &codebook = backoff_codebooks[order];
+        float v = states.backoff_weight[st];
+        float q = codebook.decode(codebook.encode(v));
+        backoff_error[order].add(v, q);
+        states.backoff_weight[st] = q;
+      }
+    }
+    compute_best_prob();
+    
+    // transitions of n-grams leave states of order n-1, backoff weights of
+    // n-grams belong to states of order n
+    for (int level=1; level<=ngramOrder; ++level) {
+      const QuantizationError &te = trans_error[level-1];
+      fprintf(stderr, "%d-grams quantization error (%d bits): "
+              "%lu transitions rms %g max %g", level, quant_bits,
+              (unsigned long)te.get_count(),
+              te.get_rms_error(), te.get_max_error());
+      if (level < ngramOrder) {
+        const QuantizationError &be = backoff_error[level];
+        fprintf(stderr, ", %lu backoffs rms %g max %g",
+                (unsigned long)be.get_count(),
+                be.get_rms_error(), be.get_max_error());
+      }
+      fprintf(stderr, "\n");
+    }
+  }
+
+  // States are coded by increasing fan out, and by index among states with
+  // the same fan out. Every chunk of states counts its fan outs, the first
+  // code of every fan out in every chunk is a prefix sum over the previous
+  // chunks, and then chunks code their states in parallel.
   void BinarizeArpa::rename_states() {
     cod2state = new int[num_useful_states];
-    int aux_cont_states = 0;
-
-    int2int_dict_type first_state_dict; 
+    
     // traverse fanouts in a sorted way (ordered map)
+    std::vector<int> fan_outs, first_state;
+    int aux_cont_states = 0;
     for (int2int_dict_type::iterator it = fan_out_dict.begin();
          it != fan_out_dict.end();
          ++it) {
-      first_state_dict[it->first] = aux_cont_states;
+      fan_outs.push_back(it->first);
+      first_state.push_back(aux_cont_states);
       aux_cont_states += it->second;
     }
     assert(aux_cont_states == num_useful_states);
+    const size_t num_fan_outs = fan_outs.size();
+    
+    const size_t grain = parallel_grain(num_states);
+    const size_t num_chunks = (num_states + grain - 1u) / grain;
+    // next_cod[c*num_fan_outs + f] counts, and later codes, states of chunk c
+    // with fan out fan_outs[f]
+    std::vector<int> next_cod(num_chunks * num_fan_outs, 0);
+    Config::thread_pool->parallel_for(0u, num_states, grain,
+                                      [&](size_t begin, size_t end) {
+        int *count = next_cod.data() + (begin / grain) * num_fan_outs;
+        for (size_t st=begin; st<end; ++st) {
+          if (!is_useless_state(st)) {
+            count[std::lower_bound(fan_outs.begin(), fan_outs.end(),
+                                   states.fan_out.get(st)) - fan_outs.begin()]++;
+          }
+        }
+      });
+    Config::thread_pool->parallel_for(0u, num_fan_outs, 64u,
+                                      [&](size_t begin, size_t end) {
+        for (size_t f=begin; f<end; ++f) {
+          int cod = first_state[f];
+          for (size_t c=0; c<num_chunks; ++c) {
+            int count = next_cod[c*num_fan_outs + f];
+            next_cod[c*num_fan_outs + f] = cod;
+            cod += count;
+          }
+        }
+      });
+    Config::thread_pool->parallel_for(0u, num_states, grain,
+                                      [&](size_t begin, size_t end) {
+        int *cods = next_cod.data() + (begin / grain) * num_fan_outs;
+        for (size_t st=begin; st<end; ++st) {
+          if (!is_useless_state(st)) {
+            int cod = cods[std::lower_bound(fan_outs.begin(), fan_outs.end(),
+                                            states.fan_out.get(st)) - fan_outs.begin()]++;
+            states.cod.set(st, cod);
+            cod2state[cod] = st;
+          } else { // useless state
+            states.cod.set(st, num_states+1);
+          }
+        }
+      });
+    Config::thread_pool->parallel_for(0u, num_states, grain,
+                                      [this](size_t begin, size_t end) {
+        for (size_t st=begin; st<end; ++st) {
+          int back;
+          if (!is_useless_state(st) &&
+              (back = states.backoff_dest.get(st)) != no_backoff)
+            states.backoff_dest.set(st, renamed_state(back));
+        }
+      });
+    initial_cod = renamed_state(initial_st);
+    final_cod   = renamed_state(final_st);
+    lowest_cod  = renamed_state(zerogram_st);
+  }
 
-    // unloop final_st as special case
-    int fanout = states[final_st].fan_out;
-    int cod = first_state_dict[fanout]++;
-    states[final_st].cod = cod;
-    cod2state[cod] = final_st;
-    // rest of states
-    for (int st=final_st+1; st<num_states; ++st) {
-      fanout = states[st].fan_out;
-      if (fanout>0) { // useful state
-        cod = first_state_dict[fanout]++;
-        states[st].cod = cod;
-        cod2state[cod] = st;
-      } else { // useless state
-        states[st].cod = num_states+1;
+  void BinarizeArpa::rename_transitions() {
+    Config::thread_pool->parallel_for(0u, num_transitions,
+                                      parallel_grain(num_transitions),
+                                      [this](size_t begin, size_t end) {
+        for (size_t trans=begin; trans<end; ++trans) {
+          transitions.origin.set(trans, renamed_state(transitions.origin.get(trans)));
+          transitions.dest.set(trans, renamed_state(transitions.dest.get(trans)));
+        }
+      });
+  }
+
+  // Moves useful states to the position given by their code and releases
+  // useless ones, so states are indexed by code and cod2state is not needed
+  void BinarizeArpa::compact_states() {
+    StateArrays compacted;
+    compacted.create(num_useful_states,
+                     states.backoff_dest.get_width(),
+                     states.fan_out.get_width(),
+                     states.order.get_width());
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      const int st = cod2state[cod];
+      compacted.fan_out.set(cod, states.fan_out.get(st));
+      compacted.backoff_dest.set(cod, states.backoff_dest.get(st));
+      compacted.cod.set(cod, cod);
+      compacted.order.set(cod, states.order.get(st));
+      compacted.best_prob[cod] = states.best_prob[st];
+      compacted.backoff_weight[cod] = states.backoff_weight[st];
+    }
+    states.swap(compacted);
+    states.advise(MADV_NORMAL);
+    compacted.release();
+    delete[] cod2state;
+    cod2state = 0;
+    num_states = num_useful_states;
+  }
+    
+  // After renaming, states are coded by increasing fan out, so the position
+  // of the first transition of every origin is known, and transitions are
+  // moved to their origin block and sorted by word inside it. Transitions of
+  // useless states are discarded. In out-of-core mode, when they do not fit in
+  // the memory budget, they are sorted by external memory runs which are
+  // merged while writing.
+  void BinarizeArpa::sort_transitions() {
+    const size_t memory = Config::getOutOfCoreMemory();
+    if (memory > 0u &&
+        sizeof(LiraBinaryTransition)*num_useful_transitions > memory) {
+      external_sort.reset(new ExternalTransitionSort(memory));
+      external_sort->create_runs(transitions, num_transitions,
+                                 num_useful_states);
+      assert(external_sort->size() == static_cast<size_t>(num_useful_transitions));
+      fprintf(stderr,"%lu sorted runs spilled to disk\n",
+              (unsigned long)external_sort->get_num_runs());
+      transitions.release();
+      return;
+    }
+    std::vector<int> first(num_useful_states + 1);
+    first[0] = 0;
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      first[cod+1] = first[cod] + states.fan_out.get(code_to_state(cod));
+    }
+    assert(first[num_useful_states] == num_useful_transitions);
+    TransitionArrays sorted;
+    sorted.create(num_useful_transitions,
+                  transitions.origin.get_width(),
+                  transitions.word.get_width());
+    sort_transitions_by_origin(transitions, num_transitions,
+                               first.data(), num_useful_states, sorted);
+    transitions.swap(sorted);
+    sorted.release();
+  }
+
+  // Calls f for every useful transition in LIRA order, from the sorted
+  // arrays or merging the external sort runs
+  template<typename F>
+  void BinarizeArpa::for_each_sorted_transition(F f) {
+    LiraBinaryTransition t;
+    if (external_sort.get() != 0) {
+      ExternalTransitionSort::Merger merger(*external_sort);
+      while (merger.next(t)) f(t);
+    }
+    else {
+      for (int trans=0; trans<num_useful_transitions; ++trans) {
+        t.origin = transitions.origin.get(trans);
+        t.dest   = transitions.dest.get(trans);
+        t.word   = transitions.word.get(trans);
+        t.prob   = transitions.trans_prob[trans];
+        f(t);
       }
     }
-    for (int st=0; st<num_states; ++st) {
-      if (!is_useless_state(st) &&
-          states[st].backoff_dest != no_backoff)
-        states[st].backoff_dest = renamed_state(states[st].backoff_dest);
+  }
+
+  void BinarizeArpa::write_lira_states(BufferedWriter &w) {
+    w.printf("# initial state, final state and lowest state\n%d %d %d\n",
+             initial_cod, final_cod, lowest_cod);
+    w.printf("# state backoff_st 'weight(state->backoff_st)' [max_transition_prob]\n"
+             "# backoff_st == -1 means there is no backoff\n");
+
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      int st = code_to_state(cod);
+      if (st < num_states) { // "%d %d %g %g\n"
+        w.put_int(cod);
+        w.put_char(' ');
+        w.put_int(states.backoff_dest.get(st));
+        w.put_char(' ');
+        w.put_float(states.backoff_weight[st]);
+        w.put_char(' ');
+        w.put_float(states.best_prob[st]);
+        w.put_char('\n');
+      }
     }
   }
 
-  void BinarizeArpa::rename_transitions() {
-    for (int trans=0; trans<num_transitions; ++trans) {
-      transitions[trans].origin = renamed_state(transitions[trans].origin);
-      transitions[trans].dest   = renamed_state(transitions[trans].dest);
+  void BinarizeArpa::write_lira_transitions(BufferedWriter &w) {
+    w.printf("# transitions\n# orig dest word prob\n");
+    for_each_sorted_transition([&w](const LiraBinaryTransition &t) {
+        // "%d %d %d %g\n"
+        w.put_int(t.origin);
+        w.put_char(' ');
+        w.put_int(t.dest);
+        w.put_char(' ');
+        w.put_int(t.word);
+        w.put_char(' ');
+        w.put_float(t.prob);
+        w.put_char('\n');
+      });
+  }
+
+  void BinarizeArpa::write_lira_text(BufferedWriter &w) {
+    w.printf("# number of words and words\n%d\n",voc.get_vocab_size());
+    voc.writeDictionary(w);
+    w.printf("# max order of n-gram\n%d\n",ngramOrder);
+    w.printf("# number of states\n%d\n",num_useful_states);
+    w.printf("# number of transitions\n%d\n",num_useful_transitions);
+    w.printf("# bound max trans prob\n%f\n",max_bound);
+    
+    int different_fan_outs = fan_out_dict.size();
+    w.printf("# how many different number of transitions\n%d\n"
+             "# \"x y\" means x states have y transitions\n",
+             different_fan_outs);
+    for (int2int_dict_type::iterator it = fan_out_dict.begin();
+         it != fan_out_dict.end();
+         ++it) {
+      w.printf("%d %d\n",it->second,it->first);
     }
+
+    write_lira_states(w);
+    write_lira_transitions(w);
   }
+
+  static void write_padding(BufferedWriter &w, uint64_t &pos, uint64_t next) {
+    static const char zeros[LIRA_BINARY_ALIGNMENT] = { 0 };
+    assert(next >= pos && next - pos <= LIRA_BINARY_ALIGNMENT);
+    w.put_string(zeros, next - pos);
+    pos = next;
+  }
+  
+  void BinarizeArpa::make_lira_binary_header(LiraBinaryHeader &header) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIRA_BINARY_MAGIC, sizeof(header.magic));
+    header.version         = LIRA_BINARY_VERSION;
+    header.byte_order      = LIRA_BINARY_BYTE_ORDER;
+    header.vocab_size      = voc.get_vocab_size();
+    header.ngram_order     = ngramOrder;
+    header.num_states      = num_useful_states;
+    header.num_transitions = num_useful_transitions;
+    header.initial_state   = initial_cod;
+    header.final_state     = final_cod;
+    header.lowest_state    = lowest_cod;
+    header.num_fan_outs    = fan_out_dict.size();
+    header.max_bound       = max_bound;
+    header.quant_bits      = quant_bits;
+    if (quant_bits > 0) {
+      header.state_bits    = bit_width(num_useful_states);
+      header.word_bits     = bit_width(voc.get_vocab_size() + 1);
+    }
+    header.vocab_offset    = lira_binary_align(sizeof(header));
+    header.vocab_bytes     = voc.getBinaryDictionarySize();
+    header.fan_outs_offset = lira_binary_align(header.vocab_offset +
+                                               header.vocab_bytes);
+    header.states_offset   = lira_binary_align(header.fan_outs_offset +
+                                               sizeof(LiraBinaryFanOut)*header.num_fan_outs);
+    if (quant_bits == 0) {
+      header.transitions_offset = lira_binary_align(header.states_offset +
+                                                    sizeof(LiraBinaryState)*header.num_states);
+      header.file_size       = header.transitions_offset +
+        sizeof(LiraBinaryTransition)*header.num_transitions;
+    }
+    else {
+      const uint64_t code_size = quant_bits / 8;
+      const uint64_t backoffs_size =
+        lira_binary_column_bytes(header.num_states, header.state_bits);
+      const uint64_t dests_size =
+        lira_binary_column_bytes(header.num_transitions, header.state_bits);
+      const uint64_t words_size =
+        lira_binary_column_bytes(header.num_transitions, header.word_bits);
+      header.backoff_dests_offset =
+        lira_binary_align(header.states_offset + sizeof(float)*header.num_states);
+      header.transitions_offset =
+        lira_binary_align(header.backoff_dests_offset + backoffs_size);
+      header.transition_words_offset =
+        lira_binary_align(header.transitions_offset + dests_size);
+      header.state_orders_offset =
+        lira_binary_align(header.transition_words_offset + words_size);
+      header.state_codes_offset = lira_binary_align(header.state_orders_offset +
+                                                    sizeof(uint8_t)*header.num_states);
+      header.transition_codes_offset = lira_binary_align(header.state_codes_offset +
+                                                         code_size*header.num_states);
+      header.codebooks_offset = lira_binary_align(header.transition_codes_offset +
+                                                  code_size*header.num_transitions);
+      header.file_size = header.codebooks_offset +
+        sizeof(float)*(2u*ngramOrder << quant_bits);
+    }
+  }
+  
+  void BinarizeArpa::write_lira_binary(BufferedWriter &w) {
+    LiraBinaryHeader header;
+    make_lira_binary_header(header);
+
+    uint64_t pos = sizeof(header);
+    w.put_string((const char*)&header, sizeof(header));
     
-  void BinarizeArpa::sort_transitions() {
-    AprilUtils::Sort(transitions, num_transitions);
+    write_padding(w, pos, header.vocab_offset);
+    voc.writeBinaryDictionary(w);
+    pos += header.vocab_bytes;
+
+    write_padding(w, pos, header.fan_outs_offset);
+    for (int2int_dict_type::iterator it = fan_out_dict.begin();
+         it != fan_out_dict.end();
+         ++it) {
+      LiraBinaryFanOut fo = { it->second, it->first };
+      w.put_string((const char*)&fo, sizeof(fo));
+    }
+    pos += sizeof(LiraBinaryFanOut)*header.num_fan_outs;
+    write_padding(w, pos, header.states_offset);
+    
+    if (quant_bits > 0) {
+      write_lira_binary_quantized(w, header);
+      return;
+    }
+
+    // states are unpacked in cod order by blocks
+    const int BLOCK_SIZE = 65536;
+    UniquePtr<LiraBinaryState []> block(new LiraBinaryState[BLOCK_SIZE]);
+    for (int cod=0; cod<num_useful_states; cod+=BLOCK_SIZE) {
+      int n = AprilUtils::min(BLOCK_SIZE, num_useful_states - cod);
+      for (int i=0; i<n; ++i) {
+        const int st = code_to_state(cod+i);
+        block[i].backoff_dest   = states.backoff_dest.get(st);
+        block[i].backoff_weight = states.backoff_weight[st];
+        block[i].best_prob      = states.best_prob[st];
+      }
+      w.put_string((const char*)block.get(), sizeof(LiraBinaryState)*n);
+    }
+    pos += sizeof(LiraBinaryState)*header.num_states;
+
+    write_padding(w, pos, header.transitions_offset);
+    for_each_sorted_transition([&w](const LiraBinaryTransition &t) {
+        w.put_string((const char*)&t, sizeof(t));
+      });
+  }
+
+  // Writes a code with quant_bits/8 bytes
+  static void put_code(BufferedWriter &w, int quant_bits, int code) {
+    if (quant_bits == 8) {
+      w.put_char(static_cast<char>(code));
+    }
+    else {
+      uint16_t code16 = code;
+      w.put_string((const char*)&code16, sizeof(code16));
+    }
   }
 
-  void BinarizeArpa::write_lira_states(StreamInterface *f) {
-    f->printf("# initial state, final state and lowest state\n%d %d %d\n",
-              states[initial_st].cod,
-              states[final_st].cod,
-              states[zerogram_st].cod);
-    f->printf("# state backoff_st 'weight(state->backoff_st)' [max_transition_prob]\n"
-              "# backoff_st == -1 means there is no backoff\n");
+  // Writes a packed column in the layout of PackedArray, values are given in
+  // order and -1 is stored with all the bits set
+  class PackedColumnWriter {
+    BufferedWriter &w;
+    const int width;
+    const uint64_t mask;
+    uint64_t word;
+    int used;
+
+    void put_word() {
+      w.put_string((const char*)&word, sizeof(word));
+    }
+    
+  public:
+    PackedColumnWriter(BufferedWriter &w, int width) :
+      w(w), width(width), mask((uint64_t(1u) << width) - 1u),
+      word(0u), used(0) { }
+    
+    void put(int32_t value) {
+      const uint64_t x = static_cast<uint64_t>(value) & mask;
+      word |= x << used;
+      used += width;
+      if (used >= 64) {
+        put_word();
+        used -= 64;
+        word = (used > 0) ? (x >> (width - used)) : 0u;
+      }
+    }
+    
+    // writes the last partial word and the extra word of PackedArray
+    void finish() {
+      if (used > 0) put_word();
+      word = 0u;
+      put_word();
+    }
+  };
+
+  // States and transitions after the fan outs section, values have been
+  // quantized by quantize_probabilities() so they are found exactly in the
+  // codebooks
+  void BinarizeArpa::write_lira_binary_quantized(BufferedWriter &w,
+                                                 const LiraBinaryHeader &header) {
+    uint64_t pos = header.states_offset;
+    const uint64_t code_size = quant_bits / 8;
+    
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      const float best_prob = states.best_prob[code_to_state(cod)];
+      w.put_string((const char*)&best_prob, sizeof(best_prob));
+    }
+    pos += sizeof(float)*header.num_states;
+
+    write_padding(w, pos, header.backoff_dests_offset);
+    PackedColumnWriter backoff_dests(w, header.state_bits);
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      backoff_dests.put(states.backoff_dest.get(code_to_state(cod)));
+    }
+    backoff_dests.finish();
+    pos += lira_binary_column_bytes(header.num_states, header.state_bits);
+
+    // origins are not written, they are given by the fan outs
+    write_padding(w, pos, header.transitions_offset);
+    PackedColumnWriter dests(w, header.state_bits);
+    for_each_sorted_transition([&dests](const LiraBinaryTransition &t) {
+        dests.put(t.dest);
+      });
+    dests.finish();
+    pos += lira_binary_column_bytes(header.num_transitions, header.state_bits);
+
+    write_padding(w, pos, header.transition_words_offset);
+    PackedColumnWriter words(w, header.word_bits);
+    for_each_sorted_transition([&words](const LiraBinaryTransition &t) {
+        words.put(t.word);
+      });
+    words.finish();
+    pos += lira_binary_column_bytes(header.num_transitions, header.word_bits);
+
+    write_padding(w, pos, header.state_orders_offset);
+    std::vector<uint8_t> orders(num_useful_states);
+    for (int cod=0; cod<num_useful_states; ++cod) {
+      orders[cod] = states.order.get(code_to_state(cod));
+    }
+    w.put_string((const char*)orders.data(), sizeof(uint8_t)*num_useful_states);
+    pos += sizeof(uint8_t)*header.num_states;
 
+    write_padding(w, pos, header.state_codes_offset);
     for (int cod=0; cod<num_useful_states; ++cod) {
-      int st = cod2state[cod];
-      if (st < num_states)
-        f->printf("%d %d %g %g\n",
-                  cod,
-                  states[st].backoff_dest,
-                  states[st].backoff_weight,
-                  states[st].best_prob);
+      const int st = code_to_state(cod);
+      put_code(w, quant_bits,
+               backoff_codebooks[states.order.get(st)].encode(states.backoff_weight[st]));
+    }
+    pos += code_size*header.num_states;
+
+    // origins are already renamed, orders are taken from the orders vector
+    write_padding(w, pos, header.transition_codes_offset);
+    for_each_sorted_transition([&](const LiraBinaryTransition &t) {
+        put_code(w, quant_bits, trans_codebooks[orders[t.origin]].encode(t.prob));
+      });
+    pos += code_size*header.num_transitions;
+
+    write_padding(w, pos, header.codebooks_offset);
+    for (int order=0; order<ngramOrder; ++order) {
+      w.put_string((const char*)trans_codebooks[order].get(),
+             sizeof(float)*trans_codebooks[order].size());
+    }
+    for (int order=0; order<ngramOrder; ++order) {
+      w.put_string((const char*)backoff_codebooks[order].get(),
+             sizeof(float)*backoff_codebooks[order].size());
     }
   }
 
-  void BinarizeArpa::write_lira_transitions(StreamInterface *f) {
-    f->printf("# transitions\n# orig dest word prob\n");
-    for (int trans=0; trans<num_useful_transitions; ++trans) {
-      f->printf("%d %d %d %g\n",
-                transitions[trans].origin,
-                transitions[trans].dest,
-                transitions[trans].word,
-                transitions[trans].trans_prob);
+  // Arrays of the snapshot, in the order of ArpaSnapshotArray
+  void BinarizeArpa::get_snapshot_arrays(PackedArray **packed,
+                                         FloatArray **floats) {
+    PackedArray *p[SNAPSHOT_NUM_ARRAYS] = {
+      &states.fan_out, &states.backoff_dest, &states.order, 0, 0,
+      &transitions.origin, &transitions.dest, &transitions.word, 0
+    };
+    FloatArray *f[SNAPSHOT_NUM_ARRAYS] = {
+      0, 0, 0, &states.best_prob, &states.backoff_weight,
+      0, 0, 0, &transitions.trans_prob
+    };
+    for (int i=0; i<SNAPSHOT_NUM_ARRAYS; ++i) {
+      packed[i] = p[i];
+      floats[i] = f[i];
     }
   }
 
-  void BinarizeArpa::generate_lira(const char *liraFilename) {
+  void BinarizeArpa::write_snapshot(const char *snapshotFilename) {
+    if (states.fan_out.get_size() == 0 || prepared) {
+      ERROR_EXIT(1, "Snapshots are written after processArpa() and before "
+                 "generating a LIRA model\n");
+    }
+    fprintf(stderr,"writing snapshot \"%s\"\n",snapshotFilename);
+    metrics.begin("snapshot");
+    ArpaSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARPA_SNAPSHOT_MAGIC, sizeof(ARPA_SNAPSHOT_MAGIC));
+    header.version         = ARPA_SNAPSHOT_VERSION;
+    header.byte_order      = ARPA_SNAPSHOT_BYTE_ORDER;
+    header.vocab_size      = voc.get_vocab_size();
+    header.ngram_order     = ngramOrder;
+    header.num_states      = num_states;
+    header.num_transitions = num_transitions;
+    header.initial_state   = initial_st;
+    header.begin_ccue      = begin_ccue;
+    header.end_ccue        = end_ccue;
+    header.vocab_offset    = arpa_snapshot_align(sizeof(header));
+    header.vocab_bytes     = voc.getBinaryDictionarySize();
+    PackedArray *packed[SNAPSHOT_NUM_ARRAYS];
+    FloatArray  *floats[SNAPSHOT_NUM_ARRAYS];
+    get_snapshot_arrays(packed, floats);
+    const char *data[SNAPSHOT_NUM_ARRAYS];
+    size_t bytes[SNAPSHOT_NUM_ARRAYS];
+    uint64_t offset = header.vocab_offset + header.vocab_bytes;
+    for (int i=0; i<SNAPSHOT_NUM_ARRAYS; ++i) {
+      const size_t n = (i < SNAPSHOT_ORIGIN) ? num_states : num_transitions;
+      if (packed[i] != 0) {
+        header.widths[i] = packed[i]->get_width();
+        data[i]  = (const char*)packed[i]->get_words();
+        bytes[i] = PackedArray::get_words_bytes(n, header.widths[i]);
+      }
+      else {
+        data[i]  = (const char*)floats[i]->get();
+        bytes[i] = AprilUtils::max(n, size_t(1u)) * sizeof(float);
+      }
+      header.offsets[i] = offset = arpa_snapshot_align(offset);
+      offset += bytes[i];
+    }
+    header.file_size = offset;
+
+    SharedPtr<StreamInterface> f = openFile(snapshotFilename,"w");
+    BufferedWriter w(f.get());
+    uint64_t pos = 0u;
+    auto pad_to = [&w, &pos](uint64_t offset) {
+      for (; pos < offset; ++pos) w.put_char('\0');
+    };
+    w.put_string((const char*)&header, sizeof(header));
+    pos += sizeof(header);
+    pad_to(header.vocab_offset);
+    voc.writeBinaryDictionary(w);
+    pos += header.vocab_bytes;
+    for (int i=0; i<SNAPSHOT_NUM_ARRAYS; ++i) {
+      pad_to(header.offsets[i]);
+      w.put_string(data[i], bytes[i]);
+      pos += bytes[i];
+    }
+    w.flush();
+    assert(w.get_bytes_written() == header.file_size);
+    metrics.end(num_states + num_transitions, header.file_size);
+  }
+
+  // Passes after parsing which leave useful states renamed and transitions
+  // sorted, ready to be written
+  void BinarizeArpa::prepare_lira() {
+    prepared = true;
+    // the passes over states are mostly sequential from now on
+    states.advise(MADV_NORMAL);
+
+    if (prune_prob > logZero || prune_entropy > 0.0) {
+      fprintf(stderr,"pruning transitions\n");
+      metrics.begin("prune");
+      const int before = num_transitions;
+      prune_transitions();
+      metrics.end(before);
+    }
+    
     // compute getBestProb
     fprintf(stderr,"computing best prob\n");
+    metrics.begin("best_prob");
     compute_best_prob();
+    metrics.end(num_states);
 
     // detect states with fanout zero which are not final, they are to
     // be removed
     fprintf(stderr,"bypassing states to be removed for backoff purposes\n");
+    metrics.begin("bypass_backoff");
     bypass_backoff_useless_states_and_compute_fanout();
+    metrics.end(num_states);
 
     fprintf(stderr,"bypassing useless destination states\n");
+    metrics.begin("bypass_destination");
     bypass_destination_useless_states();
+    metrics.end(num_transitions);
+
+    if (quant_bits > 0) {
+      fprintf(stderr,"quantizing probabilities\n");
+      metrics.begin("quantize");
+      quantize_probabilities();
+      metrics.end(num_states + num_transitions);
+    }
     
     fprintf(stderr,"renaming states\n");
+    metrics.begin("rename_states");
     rename_states();
+    metrics.end(num_states);
 
     fprintf(stderr,"renaming transitions\n");
+    metrics.begin("rename_transitions");
     rename_transitions();
+    metrics.end(num_transitions);
+
+    if (low_memory) {
+      fprintf(stderr,"compacting states\n");
+      metrics.begin("compact_states");
+      compact_states();
+      metrics.end(num_useful_states);
+    }
 
     // sort the vector of transitions first by renamed origin state
     // and second by word
     fprintf(stderr,"sorting transitions\n");
+    metrics.begin("sort");
     sort_transitions();
+    metrics.end(num_useful_transitions);
+  }
 
+  void BinarizeArpa::generate_lira(const char *liraFilename,
+                                   LiraFormat format) {
+    prepare_lira();
+    
     fprintf(stderr,"opening file \"%s\"\n",liraFilename);
+    metrics.begin("write");
     
     SharedPtr<StreamInterface> f = openFile(liraFilename,"w");
-    f->printf("# number of words and words\n%d\n",voc.get_vocab_size());
-    voc.writeDictionary(f.get());
-    f->printf("# max order of n-gram\n%d\n",ngramOrder);
-    f->printf("# number of states\n%d\n",num_useful_states);
-    f->printf("# number of transitions\n%d\n",num_useful_transitions);
-    f->printf("# bound max trans prob\n%f\n",max_bound);
-    
-    int different_fan_outs = fan_out_dict.size();
-    f->printf("# how many different number of transitions\n%d\n"
-              "# \"x y\" means x states have y transitions\n",
-              different_fan_outs);
-    for (int2int_dict_type::iterator it = fan_out_dict.begin();
-         it != fan_out_dict.end();
-         ++it) {
-      f->printf("%d %d\n",it->second,it->first);
+    // .gz and .zst outputs are compressed by blocks in the thread pool
+    ParallelCompressor::Format compression;
+    UniquePtr<ParallelCompressor> compressor;
+    UniquePtr<BufferedWriter> w;
+    if (ParallelCompressor::format_from_filename(liraFilename, compression)) {
+      compressor.reset(new ParallelCompressor(f.get(), compression));
+      w.reset(new BufferedWriter(compressor.get()));
     }
-
-    write_lira_states(f.get());
-    write_lira_transitions(f.get());
+    else {
+      w.reset(new BufferedWriter(f.get()));
+    }
+    if (format == LIRA_BINARY) {
+      write_lira_binary(*w);
+    }
+    else {
+      write_lira_text(*w);
+    }
+    w->flush();
+    if (compressor.get() != 0) compressor->finish();
 
     fprintf(stderr,"closing file \"%s\"\n",liraFilename);
+
+    metrics.end(num_useful_states + num_useful_transitions,
+                w->get_bytes_written());
+    fprintf(stderr,"peak RSS %.1f MB\n", Metrics::get_max_rss());
   }    
 
+  LiraModel *BinarizeArpa::generate_lira_model() {
+    prepare_lira();
+    
+    fprintf(stderr,"writing binary model in memory\n");
+    metrics.begin("write");
+    LiraBinaryHeader header;
+    make_lira_binary_header(header);
+    UniquePtr<LiraModel> model(new LiraModel(header.file_size));
+    BufferedWriter w(model->get_data(), header.file_size);
+    write_lira_binary(w);
+    w.flush();
+    assert(w.get_bytes_written() == header.file_size);
+    metrics.end(num_useful_states + num_useful_transitions,
+                w.get_bytes_written());
+    fprintf(stderr,"peak RSS %.1f MB\n", Metrics::get_max_rss());
+    return model.release();
+  }
+
   void BinarizeArpa::processArpa() {
-    processArpaHeader();
+    metrics.begin("header");
+    for (int level=0; level<MAX_NGRAM_ORDER; ++level) {
+      counts[level] = 0;
+    }
+    for (size_t s=0; s<sources.size(); ++s) {
+      ArpaSource &src = *sources[s];
+      processArpaHeader(src);
+      ngramOrder = AprilUtils::max(ngramOrder, src.ngramOrder);
+      for (int level=0; level<src.ngramOrder; ++level) {
+        counts[level] += src.counts[level];
+      }
+    }
+    metrics.end(ngramOrder);
     fprintf(stderr,"arpa header processed\n");
 
     fprintf(stderr,"creating output vectors\n");
+    metrics.begin("create_output_vectors");
     create_output_vectors();
+    metrics.end(0u, states.get_bytes() + transitions.get_bytes());
     fprintf(stderr,"output vectors created\n");
 
     if (ngramOrder>1) {
@@ -488,10 +1816,25 @@ namespace Arpa2Lira {
     }
     for (int level=1; level<=ngramOrder; ++level) {
       fprintf(stderr,"extractNgramLevel(%d)\n",level);
-      extractNgramLevel(level);
+      char name[20];
+      sprintf(name,"%d-grams",level);
+      metrics.begin(name);
+      uint64_t num_bytes = extractNgramLevel(level);
+      metrics.end(counts[level-1], num_bytes);
+    }
+    fprintf(stderr,"%d states, %d transitions, %.1f MB of state and "
+            "transition arrays\n", num_states, num_transitions,
+            (states.get_bytes() + transitions.get_bytes())/1048576.0);
+    for (size_t s=0; s<sources.size(); ++s) {
+      release_input(*sources[s]);
+    }
+    // states are looked up only while parsing
+    ngram_dict.clear();
+    if (interpolating()) {
+      metrics.begin("interpolate");
+      interpolate_sources();
+      metrics.end(num_transitions);
     }
-    fprintf(stderr,"%d states, %d transitions\n",num_states,num_transitions);
-    release_mmapped_buffer(input_arpa_file);
   }
 
 } // namespace Arpa2Lira
@@ -25,100 +25,81 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <deque>
 #include <future>
-#include <string> // use in the dictionary
 #include <thread>
-#include <unordered_map>
 #include <map>
 #include <vector>
 
 #include "april-ann.h"
 
-#include "hat_trie_dict.h"
+#include "arpa_input.h"
+#include "arpa_snapshot.h"
+#include "buffered_writer.h"
+#include "external_sort.h"
+#include "lira_binary.h"
+#include "lira_model.h"
+#include "lm_arrays.h"
+#include "metrics.h"
+#include "mmapped_file.h"
+#include "ngram_hash_dict.h"
+#include "quantizer.h"
+#include "vocab_dictionary.h"
 
 namespace Arpa2Lira {
 
-  class VocabDictionary {
-    static const unsigned int MAX_WORD_SIZE = 10000u;
-    unsigned int vocabSize;
-    typedef std::unordered_map<std::string,unsigned int> dictType;
-    dictType vocabDictionary;
-  public:
-    VocabDictionary(const char *vocabFilename) : vocabSize(0u) {
-      FILE *f = fopen(vocabFilename,"r");
-      char word[MAX_WORD_SIZE];
-      while (fscanf(f,"%s",word)==1) {
-        vocabDictionary.emplace(std::string(word), ++vocabSize);
-      }
-      if (vocabDictionary.size() != vocabSize) {
-        ERROR_EXIT(1, "Improper dictionary, duplicated words found\n");
-      }
-      fclose(f);
-    }
-    unsigned int get_vocab_size() const {
-      return vocabSize;
-    }
-    unsigned int operator()(const char *word) const {
-      return vocabDictionary.find(std::string(word))->second;
-    }
-    unsigned int operator()(AprilUtils::constString cs) const {
-      return vocabDictionary.find(std::string((const char *)cs, cs.len()))->second;
-    }
-    void writeDictionary(AprilIO::StreamInterface *f) const {
-      std::vector<const char*> vec;
-      vec.resize(vocabSize,"ERROR");
-      for (dictType::const_iterator it = vocabDictionary.begin();
-           it != vocabDictionary.end();
-           ++it)
-        vec[it->second-1] = it->first.c_str();
-      for (unsigned int i=0; i<vocabSize; ++i)
-        f->printf("%s\n",vec[i]);
-    }
-  };
-
-  struct StateData {
-    int fan_out;
-    int backoff_dest;
-    int cod; // the final code in lira format
-    float best_prob;
-    float backoff_weight;
+  /// Result of parsing a newline-aligned chunk of one n-gram level
+  struct NgramChunk {
+    int num_ngrams;
+    std::vector<int> words;   // num_ngrams*level word ids
+    std::vector<float> probs; // num_ngrams pairs of (trans_prob, backoff)
+    AprilUtils::constString unknown_word; // first word out of vocabulary
   };
 
-  struct TransitionData {
-    int origin;
-    int dest;
-    int word;
-    float trans_prob;
-    
-    // for sorting purposes
-    bool operator<(const TransitionData &other) const {
-      if (origin < other.origin) return true;
-      if (origin > other.origin) return false;
-      return word < other.word;
-    }
+  /// A chunk being parsed by the thread pool, or a mark which releases the
+  /// oldest input block once all its previous chunks have been consumed
+  struct PendingChunk {
+    std::future<NgramChunk> chunk;
+    const char *end; // end of the chunk text
+    int source;      // index of the input the chunk belongs to
+    bool release_block;
   };
 
-  struct mmapped_file_data {
-    // NOT USED AprilUtils::UniquePtr<char []> filename;
-    int file_descriptor;
-    size_t file_size;
-    char *file_mmapped;
+  struct TransitionIndex;
+  
+  enum LiraFormat {
+    LIRA_TEXT,
+    LIRA_BINARY // see lira_binary.h
   };
-
+  
   class BinarizeArpa {
 
     VocabDictionary voc;
     static const int MAX_NGRAM_ORDER=20;
-    int counts[MAX_NGRAM_ORDER];
+    /// Approximated size in bytes of every chunk parsed by a worker thread
+    static const size_t NGRAM_CHUNK_SIZE = 4u<<20;
+    /// Maximum number of interpolated ARPA inputs
+    static const int MAX_SOURCES=255;
+
+    /// An ARPA input and the counts of its header
+    struct ArpaSource {
+      AprilUtils::UniquePtr<ArpaInput> input;
+      AprilUtils::constString workingInput; // remaining text of current block
+      int acquired_blocks;
+      int ngramOrder;
+      int counts[MAX_NGRAM_ORDER];
+      float weight; // interpolation weight, they add to one
+    };
+    std::vector<ArpaSource*> sources;
+    int counts[MAX_NGRAM_ORDER]; // added over all the sources
     int ngramvec[MAX_NGRAM_ORDER];
-    AprilUtils::constString inputFile,workingInput;
-    int ngramOrder;
+    int ngramOrder; // the maximum of all the sources
 
     static const float logZero;
     static const float logOne;
     static const float log10;
 
-    float arpa_prob(float x) {
+    float arpa_prob(float x) const {
       if (x <= -99) {
         return logZero;
       }
@@ -127,13 +108,14 @@ namespace Arpa2Lira {
       }
     }
   
-    HAT_TRIE_DICT ngram_dict;
+    NgramHashDict ngram_dict;
 
     static const int final_st;
     static const int zerogram_st;
     static const int no_backoff;
     int initial_st;
-    int max_num_states;
+    int max_num_states; // current capacity of states, it grows on demand
+    int max_num_ngram_states; // upper bound of states given by the header
     int num_states;
     int num_useful_states;
     int max_num_transitions;
@@ -141,62 +123,146 @@ namespace Arpa2Lira {
     int num_useful_transitions;
     float max_bound;
 
-    int *cod2state; // vector of size num_useful_states
+    int *cod2state; // vector of size num_useful_states, 0 when compacted
+    int initial_cod, final_cod, lowest_cod; // codes of the special states
 
-    mmapped_file_data input_arpa_file;
-    mmapped_file_data states_data;
-    mmapped_file_data transitions_data;
-    
-    StateData *states;
-    TransitionData *transitions;
+    StateArrays states;
+    TransitionArrays transitions;
+    /// Used instead of transitions in out-of-core mode, when sorted
+    /// transitions do not fit in memory
+    AprilUtils::UniquePtr<ExternalTransitionSort> external_sort;
+    /// Only when several sources are interpolated, the source of every
+    /// transition and the backoff weight of every state in every source
+    std::vector<uint8_t> transition_sources;
+    std::vector< std::vector<float> > source_backoffs;
+
+    int quant_bits; // 0 means no quantization
+    bool low_memory;
+    bool prepared; // prepare_lira() has modified the parsed arrays
+    float prune_prob;     // natural log, logZero disables it
+    double prune_entropy; // relative perplexity increase, 0 disables it
+    Metrics metrics; // phases of processArpa and generate_lira
+    std::vector<Codebook> trans_codebooks;   // indexed by origin state order
+    std::vector<Codebook> backoff_codebooks; // indexed by state order
 
     int begin_ccue;
     int end_ccue;
 
     typedef std::map<int,int> int2int_dict_type;
     int2int_dict_type fan_out_dict; // ordered map for managing fan outs
-    void add_fan_out(int f);
+    static void add_fan_out(int2int_dict_type &dict, int f, int count=1);
 
     bool exists_state(int *v, int n, int &st);
-    void initialize_state(int st);
+    void initialize_state(int st, int order);
     int get_state(int *v, int sz);
+    void grow_states();
 
-    void read_mmapped_buffer(mmapped_file_data &filedata, const char *filename);
-    void create_mmapped_buffer(mmapped_file_data &filedata, size_t filesize);
-    void release_mmapped_buffer(mmapped_file_data &filedata);
+    bool interpolating() const { return sources.size() > 1; }
+    bool fill_input(ArpaSource &src);
+    void release_input(ArpaSource &src);
     void create_output_vectors();
 
-    void processArpaHeader();
+    void processArpaHeader(ArpaSource &src);
 
-    void skip_ngram_header(int level);
-    void extractNgramLevel(int level);
+    void skip_ngram_header(ArpaSource &src, int level);
+    NgramChunk parse_ngram_chunk(AprilUtils::constString cs, int level) const;
+    void process_ngram(int source, int level, int *ngram,
+                       float trans, float bo);
+    /// Returns the number of bytes of the section in all the sources
+    uint64_t extractNgramLevel(int level);
 
+    void build_transition_index(TransitionIndex &index) const;
+    int find_kept_transition(const TransitionIndex &index,
+                             int st, int word) const;
+    float backoff_prob(const TransitionIndex &index, int st, int word) const;
+    void compute_context_probs(std::vector<float> &context_prob) const;
+    void decide_pruning(TransitionIndex &index, int st,
+                        const std::vector<float> &context_prob,
+                        std::vector<double> &lower_probs) const;
+    void renormalize_backoff(const TransitionIndex &index, int st);
+    void remove_pruned_transitions(const TransitionIndex &index);
+    void prune_transitions();
+
+    int find_source_transition(const TransitionIndex &index, int source,
+                               int st, int word) const;
+    float source_prob(const TransitionIndex &index, int source,
+                      int st, int word) const;
+    void interpolate_state(TransitionIndex &index, int st,
+                           std::vector<float> &merged) const;
+    void interpolate_sources();
+    
     void compute_best_prob();
     
-    bool is_useless_state(int st) { // inline
-      return states[st].fan_out==0 && st!=final_st;
+    bool is_useless_state(int st) const { // inline
+      return states.fan_out.get(st)==0 && st!=final_st;
     }
 
-    int renamed_state(int st) {
-      return states[st].cod;
+    int renamed_state(int st) const {
+      return states.cod.get(st);
     }
     void bypass_backoff_useless_states_and_compute_fanout();
     void bypass_destination_useless_states();
     void rename_states();
     void rename_transitions();
+    void compact_states();
+    int code_to_state(int cod) const {
+      return (cod2state != 0) ? cod2state[cod] : cod;
+    }
     void sort_transitions();
+    void get_snapshot_arrays(PackedArray **packed, FloatArray **floats);
+    void prepare_lira();
+    template<typename F> void for_each_sorted_transition(F f);
+    void quantize_probabilities();
 
-    void write_lira_states(AprilIO::StreamInterface *f);
-    void write_lira_transitions(AprilIO::StreamInterface *f);
+    void write_lira_states(BufferedWriter &w);
+    void write_lira_transitions(BufferedWriter &w);
+    void write_lira_text(BufferedWriter &w);
+    void make_lira_binary_header(LiraBinaryHeader &header);
+    void write_lira_binary(BufferedWriter &w);
+    void write_lira_binary_quantized(BufferedWriter &w,
+                                     const LiraBinaryHeader &header);
+
+    BinarizeArpa(const ArpaSnapshot &snapshot);
 
   public:
     BinarizeArpa(const char *vocabFilename,
                  const char *inputFilename,
-                 const char* begin_ccue,
-                 const char* end_ccue);
+                 const char* begin_ccue = "<s>",
+                 const char* end_ccue = "</s>");
+    /// Linear interpolation of several ARPA models, the weights are
+    /// normalized to add one
+    BinarizeArpa(const char *vocabFilename,
+                 const std::vector<const char*> &inputFilenames,
+                 const std::vector<float> &weights,
+                 const char* begin_ccue = "<s>",
+                 const char* end_ccue = "</s>");
+    /// Resumes from a snapshot written by write_snapshot(), the model is
+    /// ready for generate_lira() without calling processArpa()
+    explicit BinarizeArpa(const char *snapshotFilename);
     ~BinarizeArpa();
     void processArpa();
-    void generate_lira(const char *liraFilename);
+    /// Quantizes probabilities and backoff weights with per-order codebooks
+    /// of 2^bits values, bits must be 8 or 16 (0 disables it)
+    void set_quantization_bits(int bits);
+    /// Sizes states by the number of contexts, releases parsed input and the
+    /// state dictionary as soon as possible, and compacts useful states
+    void set_low_memory(bool enabled);
+    /// Prunes n-grams of order 2 or more whose log10 probability is below the
+    /// threshold
+    void set_probability_threshold(float log10_prob);
+    /// Relative entropy (Stolcke) pruning, removes n-grams of order 2 or more
+    /// whose removal increases the perplexity by a relative amount below the
+    /// threshold (0 disables it)
+    void set_entropy_threshold(double threshold);
+    /// Writes the parsed model after processArpa(), so other LIRA models can
+    /// be generated from it without parsing again (see arpa_snapshot.h)
+    void write_snapshot(const char *snapshotFilename);
+    const Metrics &get_metrics() const { return metrics; }
+    void generate_lira(const char *liraFilename,
+                       LiraFormat format = LIRA_TEXT);
+    /// Same as generate_lira() with LIRA_BINARY format, but the model is
+    /// returned in memory, the caller owns it
+    LiraModel *generate_lira_model();
   };
 
 } // namespace Arpa2Lira
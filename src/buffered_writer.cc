@@ -0,0 +1,322 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "buffered_writer.h"
+#include "parallel_compressor.h"
+
+using namespace AprilUtils;
+using namespace AprilIO;
+
+namespace Arpa2Lira {
+
+  namespace {
+    typedef unsigned __int128 uint128;
+    
+    const char DIGIT_PAIRS[] =
+      "00010203040506070809"
+      "10111213141516171819"
+      "20212223242526272829"
+      "30313233343536373839"
+      "40414243444546474849"
+      "50515253545556575859"
+      "60616263646566676869"
+      "70717273747576777879"
+      "80818283848586878889"
+      "90919293949596979899";
+
+    const int G_PRECISION = 6; // significant digits of printf "%g"
+    const uint32_t G_MIN = 100000u;   // 10^(G_PRECISION-1)
+    const uint32_t G_MAX = 1000000u;  // 10^G_PRECISION
+    const int MAX_POW10 = 38;
+    
+    struct Pow10Table {
+      uint128 v[MAX_POW10 + 1];
+      Pow10Table() {
+        v[0] = 1u;
+        for (int i=1; i<=MAX_POW10; ++i) v[i] = v[i-1] * 10u;
+      }
+    };
+    const Pow10Table pow10_table;
+
+    int bit_length(uint128 x) {
+      uint64_t hi = static_cast<uint64_t>(x >> 64);
+      uint64_t lo = static_cast<uint64_t>(x);
+      if (hi != 0) return 128 - __builtin_clzll(hi);
+      if (lo != 0) return 64 - __builtin_clzll(lo);
+      return 0;
+    }
+    
+    size_t format_uint(char *dest, uint32_t x) {
+      char tmp[10];
+      char *p = tmp + sizeof(tmp);
+      while (x >= 100u) {
+        uint32_t r = x % 100u;
+        x /= 100u;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + 2*r, 2);
+      }
+      if (x >= 10u) {
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + 2*x, 2);
+      }
+      else {
+        *--p = '0' + x;
+      }
+      size_t n = tmp + sizeof(tmp) - p;
+      memcpy(dest, p, n);
+      return n;
+    }
+
+    // Computes q = floor(m * 2^e / 10^k) and r = the remainder compared with
+    // the half of the divisor (-1 below, 0 equal, 1 above). Returns false when
+    // the exact computation does not fit in 128 bits.
+    bool scale(uint32_t m, int e, int k, uint128 &q, int &r) {
+      uint128 num = m, den = 1u;
+      if (k < 0) {
+        if (-k > MAX_POW10 ||
+            bit_length(num) + bit_length(pow10_table.v[-k]) >= 127) {
+          return false;
+        }
+        num *= pow10_table.v[-k];
+      }
+      else {
+        if (k > MAX_POW10) return false;
+        den = pow10_table.v[k];
+      }
+      if (e >= 0) {
+        if (bit_length(num) + e >= 127) return false;
+        num <<= e;
+      }
+      else if (den == 1u) { // division by a power of two
+        if (-e >= 127) return false;
+        uint128 mask = (uint128(1u) << -e) - 1u;
+        uint128 rem  = num & mask;
+        uint128 half = uint128(1u) << (-e - 1);
+        q = num >> -e;
+        r = (rem < half) ? -1 : ((rem == half) ? 0 : 1);
+        return true;
+      }
+      else {
+        if (bit_length(den) - e >= 127) return false;
+        den <<= -e;
+      }
+      q = num / den;
+      uint128 rem2 = (num % den) << 1;
+      r = (rem2 < den) ? -1 : ((rem2 == den) ? 0 : 1);
+      return true;
+    }
+
+    size_t format_float_fallback(char *dest, float x) {
+      char tmp[64];
+      int n = snprintf(tmp, sizeof(tmp), "%g", x);
+      memcpy(dest, tmp, n);
+      return n;
+    }
+    
+  } // anonymous namespace
+
+  size_t BufferedWriter::format_int(char *dest, int x) {
+    if (x < 0) {
+      *dest = '-';
+      return format_uint(dest + 1, 0u - static_cast<uint32_t>(x)) + 1;
+    }
+    return format_uint(dest, static_cast<uint32_t>(x));
+  }
+
+  // Exact implementation of printf "%g" for floats: the binary value m*2^e is
+  // rounded (half to even, as glibc does) to 6 significant digits using
+  // integer arithmetic, numbers out of range fall back to snprintf.
+  size_t BufferedWriter::format_float(char *dest, float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    const bool negative = (bits >> 31) != 0;
+    const int biased_exp = (bits >> 23) & 0xFF;
+    uint32_t m = bits & 0x7FFFFFu;
+    if (biased_exp == 0xFF) return format_float_fallback(dest, x); // inf/nan
+    char *p = dest;
+    if (negative) *p++ = '-';
+    if (biased_exp == 0 && m == 0u) {
+      *p++ = '0';
+      return p - dest;
+    }
+    int e;
+    if (biased_exp == 0) { // subnormal
+      e = -149;
+    }
+    else {
+      m |= 0x800000u;
+      e = biased_exp - 150;
+    }
+    // estimate decimal exponent from floor(log2(x)), it is fixed below
+    int b = e + 31 - __builtin_clz(m);
+    int X = (b * 1233) >> 12;
+    uint128 q;
+    int r;
+    for (;;) {
+      if (!scale(m, e, X - (G_PRECISION - 1), q, r)) {
+        return format_float_fallback(dest, x);
+      }
+      if (q >= G_MAX) ++X;
+      else if (q < G_MIN) --X;
+      else break;
+    }
+    uint32_t n = static_cast<uint32_t>(q);
+    if (r > 0 || (r == 0 && (n & 1u))) {
+      if (++n == G_MAX) {
+        n = G_MIN;
+        ++X;
+      }
+    }
+    char digits[G_PRECISION];
+    format_uint(digits, n);
+    int nd = G_PRECISION;
+    while (nd > 1 && digits[nd-1] == '0') --nd;
+    if (X < -4 || X >= G_PRECISION) { // exponential notation
+      *p++ = digits[0];
+      if (nd > 1) {
+        *p++ = '.';
+        memcpy(p, digits + 1, nd - 1);
+        p += nd - 1;
+      }
+      *p++ = 'e';
+      if (X < 0) {
+        *p++ = '-';
+        X = -X;
+      }
+      else {
+        *p++ = '+';
+      }
+      if (X < 10) *p++ = '0';
+      p += format_uint(p, X);
+    }
+    else if (X >= 0) { // fixed notation with integer part
+      memcpy(p, digits, X + 1);
+      p += X + 1;
+      if (nd > X + 1) {
+        *p++ = '.';
+        memcpy(p, digits + X + 1, nd - X - 1);
+        p += nd - X - 1;
+      }
+    }
+    else { // fixed notation, 0.000ddd
+      *p++ = '0';
+      *p++ = '.';
+      for (int i=-1; i>X; --i) *p++ = '0';
+      memcpy(p, digits, nd);
+      p += nd;
+    }
+    return p - dest;
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  
+  BufferedWriter::BufferedWriter(StreamInterface *f, size_t buffer_size) :
+    f(f), compressor(0), memory(0), memory_size(0u),
+    buffer(new char[buffer_size]),
+    buffer_size(buffer_size), pos(0u), bytes_written(0u) {
+  }
+
+  BufferedWriter::BufferedWriter(ParallelCompressor *compressor,
+                                 size_t buffer_size) :
+    f(0), compressor(compressor), memory(0), memory_size(0u),
+    buffer(new char[buffer_size]),
+    buffer_size(buffer_size), pos(0u), bytes_written(0u) {
+  }
+
+  BufferedWriter::BufferedWriter(char *memory, size_t memory_size,
+                                 size_t buffer_size) :
+    f(0), compressor(0), memory(memory), memory_size(memory_size),
+    buffer(new char[buffer_size]),
+    buffer_size(buffer_size), pos(0u), bytes_written(0u) {
+  }
+
+  BufferedWriter::~BufferedWriter() {
+    flush();
+  }
+
+  void BufferedWriter::flush() {
+    if (pos > 0u) {
+      write(buffer.get(), pos);
+      pos = 0u;
+    }
+  }
+
+  void BufferedWriter::write(const char *src, size_t len) {
+    if (memory != 0) {
+      if (bytes_written + len > memory_size) {
+        ERROR_EXIT1(1, "Memory output overflow, %lu bytes\n",
+                    (unsigned long)memory_size);
+      }
+      memcpy(memory + bytes_written, src, len);
+    }
+    else if (compressor != 0) {
+      compressor->put(src, len);
+    }
+    else {
+      f->put(src, len);
+    }
+    bytes_written += len;
+  }
+
+  void BufferedWriter::put_string(const char *str, size_t len) {
+    if (len > buffer_size/2) { // large strings are written directly
+      flush();
+      write(str, len);
+    }
+    else {
+      reserve(len);
+      memcpy(buffer.get() + pos, str, len);
+      pos += len;
+    }
+  }
+  
+  int BufferedWriter::printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buffer.get() + pos, buffer_size - pos, format, ap);
+    va_end(ap);
+    if (n >= 0 && static_cast<size_t>(n) >= buffer_size - pos) {
+      // it does not fit, flush and format again
+      flush();
+      va_start(ap, format);
+      if (static_cast<size_t>(n) < buffer_size) {
+        vsnprintf(buffer.get(), buffer_size, format, ap);
+      }
+      else {
+        UniquePtr<char []> tmp(new char[n + 1]);
+        vsnprintf(tmp.get(), n + 1, format, ap);
+        write(tmp.get(), n);
+        n = 0;
+      }
+      va_end(ap);
+    }
+    if (n > 0) pos += n;
+    return n;
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,103 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef BUFFERED_WRITER_H
+#define BUFFERED_WRITER_H
+
+#include <cstddef>
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+namespace Arpa2Lira {
+
+  class ParallelCompressor;
+  
+  /// Formats numbers into a large buffer which is flushed in bulk to the
+  /// underlying stream. Integers and floats are formatted by hand, producing
+  /// exactly the same text as printf "%d" and "%g" formats. The output can go
+  /// to a stream, to a ParallelCompressor or to a memory region.
+  class BufferedWriter {
+    static const size_t DEFAULT_BUFFER_SIZE = 4u<<20;
+    static const size_t MAX_NUMBER_SIZE = 64u; // enough for any number
+    
+    AprilIO::StreamInterface *f;
+    ParallelCompressor *compressor;
+    char *memory; // destination region of memory_size bytes
+    size_t memory_size;
+    AprilUtils::UniquePtr<char []> buffer;
+    size_t buffer_size;
+    size_t pos;
+    size_t bytes_written; // bytes passed to the stream or compressor
+
+    void reserve(size_t n) {
+      if (pos + n > buffer_size) flush();
+    }
+
+    void write(const char *src, size_t len);
+    
+  public:
+    BufferedWriter(AprilIO::StreamInterface *f,
+                   size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    BufferedWriter(ParallelCompressor *compressor,
+                   size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    /// Writes into the given memory, which must be large enough
+    BufferedWriter(char *memory, size_t memory_size,
+                   size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~BufferedWriter();
+    
+    void flush();
+
+    /// Number of bytes written so far, excluding the buffered ones
+    size_t get_bytes_written() const { return bytes_written; }
+
+    void put_char(char c) {
+      reserve(1);
+      buffer[pos++] = c;
+    }
+    void put_string(const char *str, size_t len);
+    void put_string(const char *str) {
+      put_string(str, strlen(str));
+    }
+    /// Same as printf("%d")
+    void put_int(int x) {
+      reserve(MAX_NUMBER_SIZE);
+      pos += format_int(buffer.get() + pos, x);
+    }
+    /// Same as printf("%g")
+    void put_float(float x) {
+      reserve(MAX_NUMBER_SIZE);
+      pos += format_float(buffer.get() + pos, x);
+    }
+    /// For rare formatted output, it is slower than put methods
+    int printf(const char *format, ...)
+      __attribute__ ((format (printf, 2, 3)));
+
+    /// Writes x as "%d" into dest and returns the number of chars written,
+    /// dest is not '\0' terminated
+    static size_t format_int(char *dest, int x);
+    /// Writes x as "%g" into dest and returns the number of chars written,
+    /// dest is not '\0' terminated
+    static size_t format_float(char *dest, float x);
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // BUFFERED_WRITER_H
@@ -38,6 +38,9 @@ extern "C" {
 
 namespace Arpa2Lira {
   unsigned int Config::num_threads = 1u;
+  size_t Config::out_of_core_memory = 0u;
+  Config::HugePages Config::huge_pages = Config::HUGE_PAGES_TRANSPARENT;
+  Config::Prefault Config::prefault = Config::PREFAULT_NONE;
   std::string Config::tmpdir = "/tmp";
   const std::string Config::TEMPLATE_SUFIX = "/file-a2l-XXXXXX";
   AprilUtils::vector<std::string> Config::tmp_filenames;
@@ -70,6 +73,30 @@ namespace Arpa2Lira {
     return Config::num_threads;
   }
 
+  void Config::setOutOfCoreMemory(size_t bytes) {
+    Config::out_of_core_memory = bytes;
+  }
+
+  size_t Config::getOutOfCoreMemory() {
+    return Config::out_of_core_memory;
+  }
+
+  void Config::setHugePages(HugePages policy) {
+    Config::huge_pages = policy;
+  }
+
+  Config::HugePages Config::getHugePages() {
+    return Config::huge_pages;
+  }
+
+  void Config::setPrefault(Prefault policy) {
+    Config::prefault = policy;
+  }
+
+  Config::Prefault Config::getPrefault() {
+    return Config::prefault;
+  }
+
   /////////////////////////////////////////////////////////////////////////
   
   Config::SignalsManager::SignalsManager() {
@@ -20,6 +20,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <cstddef>
 #include <string>
 
 // from APRIL
@@ -30,7 +31,25 @@
 
 namespace Arpa2Lira {
   class Config {
+  public:
+    /// Page size of the anonymous buffers of the state and transition arrays
+    enum HugePages {
+      HUGE_PAGES_NONE,
+      HUGE_PAGES_TRANSPARENT, ///< madvise(MADV_HUGEPAGE), the default
+      HUGE_PAGES_EXPLICIT     ///< MAP_HUGETLB, normal pages if unavailable
+    };
+    /// How the pages of the anonymous buffers are faulted in
+    enum Prefault {
+      PREFAULT_NONE,     ///< on first touch, the default
+      PREFAULT_POPULATE, ///< MAP_POPULATE when they are mapped
+      PREFAULT_PARALLEL  ///< touched by the thread pool when they are mapped
+    };
+    
+  private:
     static unsigned int num_threads;
+    static size_t out_of_core_memory;
+    static HugePages huge_pages;
+    static Prefault prefault;
     static std::string tmpdir;
     static const std::string TEMPLATE_SUFIX;
     /// This is a list of tmp filenames generated using openTemporaryFile()
@@ -58,6 +77,15 @@ namespace Arpa2Lira {
     static void setTemporaryDirectory(const char *tmpdir_);
     static void setNumberOfThreads(unsigned int n);
     static unsigned int getNumberOfThreads();
+    /// Enables the out-of-core mode, where large arrays are backed by
+    /// temporary files and passes over them use at most the given memory
+    static void setOutOfCoreMemory(size_t bytes);
+    /// Returns 0 when the out-of-core mode is disabled
+    static size_t getOutOfCoreMemory();
+    static void setHugePages(HugePages policy);
+    static HugePages getHugePages();
+    static void setPrefault(Prefault policy);
+    static Prefault getPrefault();
   };
 } // namespace Arpa2Lira
 
@@ -0,0 +1,182 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <future>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "config.h"
+#include "external_sort.h"
+
+namespace Arpa2Lira {
+
+  ExternalTransitionSort::ExternalTransitionSort(size_t memory) :
+    memory(memory), num_transitions(0u) {
+  }
+
+  ExternalTransitionSort::~ExternalTransitionSort() {
+    for (size_t i=0; i<runs.size(); ++i) {
+      close(runs[i].file_descriptor);
+    }
+  }
+
+  // Sorts the run and writes it to the given file, it is a task of the
+  // thread pool
+  ExternalTransitionSort::Run
+  ExternalTransitionSort::write_run(std::vector<LiraBinaryTransition> *run,
+                                    int fd) {
+    std::sort(run->begin(), run->end(), transition_less);
+    Run result;
+    result.file_descriptor = fd;
+    result.size = run->size();
+    const char *p = (const char*)run->data();
+    size_t len = sizeof(LiraBinaryTransition)*run->size();
+    while (len > 0u) {
+      ssize_t n = write(result.file_descriptor, p, len);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        ERROR_EXIT1(1, "Error writing temporary run file: %s\n",
+                    strerror(errno));
+      }
+      p += n;
+      len -= n;
+    }
+    return result;
+  }
+
+  // Every thread sorts its own run, and the next run is not filled until a
+  // thread is free, so at most num_threads runs are in memory, all of them
+  // together fitting in the memory budget. Run files are created by this
+  // thread, as Config temporary files are not thread-safe, and unlinked once
+  // opened, they live until they are closed.
+  void ExternalTransitionSort::create_runs(const TransitionArrays &input,
+                                           size_t n, int num_origins) {
+    const size_t num_threads = Config::getNumberOfThreads();
+    const size_t run_size =
+      AprilUtils::max(size_t(65536u),
+                      memory / (num_threads*sizeof(LiraBinaryTransition)));
+    std::deque< std::future<Run> > pending;
+    for (size_t begin=0; begin<n; begin+=run_size) {
+      const size_t end = AprilUtils::min(n, begin + run_size);
+      if (pending.size() >= num_threads) {
+        runs.push_back(pending.front().get());
+        pending.pop_front();
+      }
+      // the input is read sequentially by this thread
+      std::vector<LiraBinaryTransition> *run =
+        new std::vector<LiraBinaryTransition>();
+      run->reserve(end - begin);
+      for (size_t i=begin; i<end; ++i) {
+        LiraBinaryTransition t;
+        t.origin = input.origin.get(i);
+        if (t.origin < 0 || t.origin >= num_origins) continue; // discarded
+        t.dest = input.dest.get(i);
+        t.word = input.word.get(i);
+        t.prob = input.trans_prob[i];
+        run->push_back(t);
+      }
+      AprilUtils::UniquePtr<char []> filename;
+      const int fd = Config::openTemporaryFile(O_CLOEXEC, filename);
+      if (fd < 0) {
+        ERROR_EXIT1(1, "Error creating temporary file: %s\n", strerror(errno));
+      }
+      unlink(filename.get());
+      pending.push_back(Config::thread_pool->enqueue([run, fd]() {
+            AprilUtils::UniquePtr< std::vector<LiraBinaryTransition> >
+              data(run);
+            return write_run(data.get(), fd);
+          }));
+    }
+    while (!pending.empty()) {
+      runs.push_back(pending.front().get());
+      pending.pop_front();
+    }
+    num_transitions = 0u;
+    for (size_t i=0; i<runs.size(); ++i) {
+      num_transitions += runs[i].size;
+    }
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+
+  ExternalTransitionSort::Merger::Merger(const ExternalTransitionSort &sorter) :
+    inputs(sorter.runs.size()) {
+    const size_t MIN_BUFFER_SIZE = 1024u, MAX_BUFFER_SIZE = 65536u;
+    const size_t num_inputs = AprilUtils::max(size_t(1u), inputs.size());
+    const size_t buffer_size =
+      AprilUtils::max(MIN_BUFFER_SIZE,
+                      AprilUtils::min(MAX_BUFFER_SIZE,
+                                      sorter.memory / num_inputs /
+                                      sizeof(LiraBinaryTransition)));
+    HeapGreater greater = { &inputs };
+    heap = std::priority_queue<int, std::vector<int>, HeapGreater>(greater);
+    for (size_t i=0; i<inputs.size(); ++i) {
+      inputs[i].run  = &sorter.runs[i];
+      inputs[i].next = 0u;
+      inputs[i].buffer.reserve(buffer_size);
+      inputs[i].pos  = 0u;
+      if (fill(inputs[i])) heap.push(i);
+    }
+  }
+
+  bool ExternalTransitionSort::Merger::fill(Input &input) {
+    const size_t n = AprilUtils::min(input.buffer.capacity(),
+                                     input.run->size - input.next);
+    input.buffer.resize(n);
+    input.pos = 0u;
+    char *p = (char*)input.buffer.data();
+    size_t len = sizeof(LiraBinaryTransition)*n;
+    off_t offset = sizeof(LiraBinaryTransition)*input.next;
+    while (len > 0u) {
+      ssize_t r = pread(input.run->file_descriptor, p, len, offset);
+      if (r <= 0) {
+        if (r < 0 && errno == EINTR) continue;
+        ERROR_EXIT1(1, "Error reading temporary file: %s\n",
+                    (r < 0) ? strerror(errno) : "unexpected end of file");
+      }
+      p += r;
+      len -= r;
+      offset += r;
+    }
+    input.next += n;
+    return n > 0u;
+  }
+
+  bool ExternalTransitionSort::Merger::next(LiraBinaryTransition &t) {
+    if (heap.empty()) return false;
+    const int i = heap.top();
+    heap.pop();
+    Input &input = inputs[i];
+    t = input.buffer[input.pos++];
+    if (input.pos < input.buffer.size() || fill(input)) heap.push(i);
+    return true;
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,104 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <cstddef>
+#include <queue>
+#include <vector>
+
+// from Arpa2Lira
+#include "lira_binary.h"
+#include "lm_arrays.h"
+
+namespace Arpa2Lira {
+
+  /// Order of transitions in LIRA format, by origin and word
+  inline bool transition_less(const LiraBinaryTransition &a,
+                              const LiraBinaryTransition &b) {
+    return ( (a.origin < b.origin) ||
+             (a.origin == b.origin && a.word < b.word) );
+  }
+
+  /// External memory sort of transitions. Runs which fit in the memory budget
+  /// are sorted concurrently by the thread pool and spilled to temporary
+  /// files, and a Merger traverses all of them in order with a heap, so the
+  /// sorted transitions are never stored together.
+  class ExternalTransitionSort {
+    struct Run {
+      int file_descriptor;
+      size_t size; // number of transitions
+    };
+    
+    size_t memory;
+    size_t num_transitions;
+    std::vector<Run> runs;
+
+    ExternalTransitionSort(const ExternalTransitionSort &);
+    ExternalTransitionSort &operator=(const ExternalTransitionSort &);
+    
+    static Run write_run(std::vector<LiraBinaryTransition> *run, int fd);
+    
+  public:
+    ExternalTransitionSort(size_t memory);
+    ~ExternalTransitionSort();
+
+    /// Sorts the first n transitions of input whose origin is in the range
+    /// [0,num_origins), the rest are discarded
+    void create_runs(const TransitionArrays &input, size_t n, int num_origins);
+
+    size_t size() const { return num_transitions; }
+    size_t get_num_runs() const { return runs.size(); }
+
+    /// Merges the runs, which are read by buffers in the calling thread,
+    /// returning the transitions in order
+    class Merger {
+      struct Input {
+        const Run *run;
+        size_t next;     // next transition of the run to be read from disk
+        std::vector<LiraBinaryTransition> buffer;
+        size_t pos;      // position in the buffer
+      };
+      struct HeapGreater {
+        const std::vector<Input> *inputs;
+        bool operator()(int a, int b) const {
+          const Input &ia = (*inputs)[a], &ib = (*inputs)[b];
+          return transition_less(ib.buffer[ib.pos], ia.buffer[ia.pos]);
+        }
+      };
+      
+      std::vector<Input> inputs;
+      std::priority_queue<int, std::vector<int>, HeapGreater> heap;
+
+      Merger(const Merger &);
+      Merger &operator=(const Merger &);
+      
+      bool fill(Input &input);
+      
+    public:
+      Merger(const ExternalTransitionSort &sorter);
+      /// Returns false when all transitions have been read
+      bool next(LiraBinaryTransition &t);
+    };
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // EXTERNAL_SORT_H
@@ -0,0 +1,146 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LIRA_BINARY_H
+#define LIRA_BINARY_H
+
+#include <stdint.h>
+
+namespace Arpa2Lira {
+
+  /*
+   * Binary LIRA format. The file is a sequence of sections, every one starting
+   * at an offset multiple of LIRA_BINARY_ALIGNMENT, so it can be mmapped and
+   * used without any parsing:
+   *
+   * - LiraBinaryHeader
+   * - vocabulary: vocab_size '\0' terminated words, sorted by word id (1..V)
+   * - fan outs: num_fan_outs LiraBinaryFanOut, sorted by fan_out
+   * - states: num_states LiraBinaryState, indexed by state code
+   * - transitions: num_transitions LiraBinaryTransition, sorted by origin
+   *   and word
+   *
+   * When quant_bits is not zero, probabilities and backoff weights are
+   * replaced by codes of quant_bits (8 or 16) bits, state codes and words are
+   * bit-packed columns, and transition origins are not stored, as they are
+   * given by the fan outs table (see below). The file contains:
+   *
+   * - header, vocabulary and fan outs as above
+   * - best probs: num_states floats, indexed by state code
+   * - backoff dests: num_states packed state codes of state_bits bits
+   * - transition dests: num_transitions packed state codes of state_bits
+   *   bits, sorted by origin and word
+   * - transition words: num_transitions packed word ids of word_bits bits
+   * - state orders: num_states uint8_t, the n-gram length of every state
+   * - state codes: num_states codes of the backoff weights
+   * - transition codes: num_transitions codes of the transition probabilities
+   * - codebooks: 2*ngram_order tables of 2^quant_bits floats, first the
+   *   transition codebooks indexed by the order of the origin state, after
+   *   them the backoff codebooks indexed by the order of the state
+   *
+   * State codes are assigned by increasing fan out, so the first transition
+   * of a state can be computed from the fan outs table: all the states of a
+   * fan out group are contiguous and own fan_out transitions each.
+   *
+   * Packed columns are the 64 bit words of PackedArray (lm_arrays.h): element
+   * i takes width bits starting at bit i*width, the low bits of a word first,
+   * and an extra word follows the last element. The value with all the bits
+   * set means -1 (no backoff).
+   *
+   * All numbers are stored with the native byte order of the writer machine,
+   * byte_order field allows to detect a mismatch.
+   */
+  
+  const char     LIRA_BINARY_MAGIC[8]  = { 'L','I','R','A','B','I','N','\0' };
+  const uint32_t LIRA_BINARY_VERSION   = 3u;
+  const uint32_t LIRA_BINARY_BYTE_ORDER = 0x01020304u;
+  const uint64_t LIRA_BINARY_ALIGNMENT = 64u;
+
+  struct LiraBinaryHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t  vocab_size;
+    int32_t  ngram_order;
+    int32_t  num_states;
+    int32_t  num_transitions;
+    int32_t  initial_state;
+    int32_t  final_state;
+    int32_t  lowest_state;
+    int32_t  num_fan_outs;
+    float    max_bound;
+    uint32_t quant_bits; // 0 when probabilities are not quantized
+    uint32_t state_bits; // widths of packed columns, 0 when quant_bits is 0
+    uint32_t word_bits;
+    uint64_t vocab_offset;
+    uint64_t vocab_bytes;
+    uint64_t fan_outs_offset;
+    uint64_t states_offset;
+    uint64_t transitions_offset;
+    uint64_t state_orders_offset;     // these six are 0 when quant_bits is 0
+    uint64_t state_codes_offset;
+    uint64_t transition_codes_offset;
+    uint64_t codebooks_offset;
+    uint64_t backoff_dests_offset;
+    uint64_t transition_words_offset;
+    uint64_t file_size;
+  };
+
+  struct LiraBinaryFanOut {
+    int32_t num_states;
+    int32_t fan_out;
+  };
+  
+  struct LiraBinaryState {
+    int32_t backoff_dest; // -1 means there is no backoff
+    float   backoff_weight;
+    float   best_prob;
+  };
+
+  struct LiraBinaryTransition {
+    int32_t origin;
+    int32_t dest;
+    int32_t word;
+    float   prob;
+  };
+
+  inline uint64_t lira_binary_align(uint64_t offset) {
+    return (offset + LIRA_BINARY_ALIGNMENT - 1) & ~(LIRA_BINARY_ALIGNMENT - 1);
+  }
+
+  /// Bytes of a packed column of n elements
+  inline uint64_t lira_binary_column_bytes(uint64_t n, int width) {
+    return ((n * width + 63u) / 64u + 1u) * sizeof(uint64_t);
+  }
+
+  /// Element i of a packed column, -1 when all its bits are set
+  inline int32_t lira_binary_column_get(const uint64_t *words, uint64_t i,
+                                        int width) {
+    const uint64_t mask = (uint64_t(1u) << width) - 1u;
+    const uint64_t bit = i * width;
+    const unsigned int off = bit & 63u;
+    uint64_t x = words[bit >> 6] >> off;
+    if (off + width > 64u) x |= words[(bit >> 6) + 1] << (64u - off);
+    x &= mask;
+    return (x == mask) ? -1 : static_cast<int32_t>(x);
+  }
+  
+} // namespace Arpa2Lira
+
+#endif // LIRA_BINARY_H
@@ -0,0 +1,70 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "lira_model.h"
+
+namespace Arpa2Lira {
+
+  LiraModel::LiraModel(size_t size) : data(0), size(size) {
+    void *ptr;
+    if (posix_memalign(&ptr, LIRA_BINARY_ALIGNMENT, size) != 0) {
+      ERROR_EXIT1(1, "Unable to allocate a model of %lu bytes\n",
+                  (unsigned long)size);
+    }
+    data = static_cast<char*>(ptr);
+  }
+
+  LiraModel::LiraModel(char *data, size_t size) : data(data), size(size) {
+    if (size < sizeof(LiraBinaryHeader) ||
+        memcmp(data, LIRA_BINARY_MAGIC, sizeof(LIRA_BINARY_MAGIC)) != 0) {
+      ERROR_EXIT(1, "The buffer is not a binary LIRA model\n");
+    }
+  }
+  
+  LiraModel::~LiraModel() {
+    free(data);
+  }
+
+  char *LiraModel::release() {
+    char *result = data;
+    data = 0;
+    size = 0u;
+    return result;
+  }
+  
+  void LiraModel::write(const char *filename) const {
+    FILE *f = fopen(filename, "wb");
+    if (f == 0) {
+      ERROR_EXIT2(1, "Unable to open %s: %s\n", filename, strerror(errno));
+    }
+    if (fwrite(data, 1u, size, f) != size || fclose(f) != 0) {
+      ERROR_EXIT2(1, "Unable to write %s: %s\n", filename, strerror(errno));
+    }
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,109 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LIRA_MODEL_H
+#define LIRA_MODEL_H
+
+#include <cstddef>
+#include <stdint.h>
+
+// from Arpa2Lira
+#include "lira_binary.h"
+
+namespace Arpa2Lira {
+
+  /// A LIRA model held in memory with the binary format of lira_binary.h, as
+  /// returned by BinarizeArpa::generate_lira_model(). The buffer is allocated
+  /// with posix_memalign() aligned to LIRA_BINARY_ALIGNMENT, so sections can
+  /// be used in place, and release() hands it over to the caller, who frees
+  /// it with free().
+  class LiraModel {
+    char *data;
+    size_t size;
+
+    template<typename T>
+    const T *section(uint64_t offset) const {
+      return reinterpret_cast<const T*>(data + offset);
+    }
+    
+  public:
+    /// Allocates an uninitialized buffer of the given size
+    explicit LiraModel(size_t size);
+    /// Adopts a buffer allocated with malloc() or posix_memalign()
+    LiraModel(char *data, size_t size);
+    ~LiraModel();
+
+    char *get_data() { return data; }
+    const char *get_data() const { return data; }
+    size_t get_size() const { return size; }
+    /// Returns the buffer, which is not owned by the model anymore
+    char *release();
+    /// Writes the buffer as a binary LIRA file
+    void write(const char *filename) const;
+    
+    const LiraBinaryHeader &get_header() const {
+      return *section<LiraBinaryHeader>(0u);
+    }
+    /// vocab_size '\0' terminated words, sorted by word id
+    const char *get_vocab() const {
+      return section<char>(get_header().vocab_offset);
+    }
+    const LiraBinaryFanOut *get_fan_outs() const {
+      return section<LiraBinaryFanOut>(get_header().fan_outs_offset);
+    }
+    
+    // sections of models without quantization
+    const LiraBinaryState *get_states() const {
+      return section<LiraBinaryState>(get_header().states_offset);
+    }
+    const LiraBinaryTransition *get_transitions() const {
+      return section<LiraBinaryTransition>(get_header().transitions_offset);
+    }
+
+    // sections of quantized models, codes are uint8_t or uint16_t, packed
+    // columns are read with lira_binary_column_get()
+    const float *get_best_probs() const {
+      return section<float>(get_header().states_offset);
+    }
+    const uint64_t *get_backoff_dests() const {
+      return section<uint64_t>(get_header().backoff_dests_offset);
+    }
+    const uint64_t *get_transition_dests() const {
+      return section<uint64_t>(get_header().transitions_offset);
+    }
+    const uint64_t *get_transition_words() const {
+      return section<uint64_t>(get_header().transition_words_offset);
+    }
+    const uint8_t *get_state_orders() const {
+      return section<uint8_t>(get_header().state_orders_offset);
+    }
+    const void *get_state_codes() const {
+      return section<char>(get_header().state_codes_offset);
+    }
+    const void *get_transition_codes() const {
+      return section<char>(get_header().transition_codes_offset);
+    }
+    const float *get_codebooks() const {
+      return section<float>(get_header().codebooks_offset);
+    }
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // LIRA_MODEL_H
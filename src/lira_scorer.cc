@@ -0,0 +1,505 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "arpa_input.h"
+#include "lira_scorer.h"
+#include "lm_arrays.h"
+
+using AprilUtils::constString;
+using AprilUtils::UniquePtr;
+
+namespace Arpa2Lira {
+
+  const int   LiraScorer::NO_BACKOFF;
+  const int   LiraScorer::BATCH_SIZE;
+  const int   LiraScorer::LINEAR_SEARCH_SIZE;
+  const float LiraScorer::LOG_ZERO = -1e12f;
+
+  namespace {
+
+    /// Lines of a text LIRA file, the input blocks always contain complete
+    /// lines and are released once they have been consumed
+    class LiraTextReader {
+      constString &block;
+      ArpaInput *input;
+    public:
+      LiraTextReader(constString &block, ArpaInput *input) :
+        block(block), input(input) { }
+      
+      constString next_line() {
+        while (block.len() == 0) {
+          input->release();
+          block = input->acquire();
+          if (block.len() == 0) {
+            ERROR_EXIT(1, "Unexpected end of the LIRA file\n");
+          }
+        }
+        return block.extract_line();
+      }
+      /// Next line which is not empty nor a comment
+      constString next_data_line() {
+        constString line;
+        do {
+          line = next_line();
+        } while (line.len() == 0 || line[0] == '#' || line[0] == '\r');
+        return line;
+      }
+      int next_int() {
+        int value;
+        constString line = next_data_line();
+        if (!line.extract_int(&value)) {
+          ERROR_EXIT(1, "Expected an integer in the LIRA file\n");
+        }
+        return value;
+      }
+    };
+
+    /// Returns the position of w in words[begin,end) or -1, comparing
+    /// several words at once
+    inline int scan_block(const int32_t *words, uint32_t begin, uint32_t end,
+                          int32_t w) {
+      uint32_t i = begin;
+#if defined(__AVX2__)
+      const __m256i key = _mm256_set1_epi32(w);
+      for (; i + 8u <= end; i += 8u) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, key)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+      }
+#endif
+#if defined(__SSE2__)
+      const __m128i key4 = _mm_set1_epi32(w);
+      for (; i + 4u <= end; i += 4u) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(words + i));
+        const int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, key4)));
+        if (mask != 0) return i + __builtin_ctz(mask);
+      }
+#endif
+      for (; i<end; ++i) {
+        if (words[i] == w) return i;
+      }
+      return -1;
+    }
+
+    /// Prefetches the words which will be read by the next search step, the
+    /// middle of long blocks or the whole of short ones
+    inline void prefetch_search(const int32_t *words, uint32_t begin,
+                                uint32_t end) {
+      const uint32_t WORDS_PER_LINE = 64u / sizeof(int32_t);
+      if (end - begin > static_cast<uint32_t>(LiraScorer::LINEAR_SEARCH_SIZE)) {
+        __builtin_prefetch(words + begin + ((end - begin) >> 1));
+      }
+      else if (begin < end) {
+        for (uint32_t i=begin; i<end; i+=WORDS_PER_LINE) {
+          __builtin_prefetch(words + i);
+        }
+        __builtin_prefetch(words + end - 1u);
+      }
+    }
+
+    /// Step of every query of a batch
+    enum BatchStage { LOAD_BLOCK, SEARCH, FOUND, DONE };
+
+    struct BatchQuery {
+      int st;
+      float logprob;
+      uint32_t begin, end; // search range, or the found transition in begin
+      BatchStage stage;
+    };
+    
+  } // anonymous namespace
+  
+  LiraScorer::LiraScorer() : ngram_order(0), num_states(0),
+                             num_transitions(0), initial_state(0),
+                             final_state(0), lowest_state(0), max_bound(0.0f),
+                             end_word(VocabDictionary::UNKNOWN_WORD) {
+  }
+
+  // States and transitions are unpacked from the binary sections, quantized
+  // values are decoded with the codebook of the order of their state
+  LiraScorer::LiraScorer(const LiraModel &model, const char *end_ccue) {
+    const LiraBinaryHeader &header = model.get_header();
+    if (header.version != LIRA_BINARY_VERSION) {
+      ERROR_EXIT2(1, "Unsupported binary LIRA version %u, expected %u\n",
+                  header.version, LIRA_BINARY_VERSION);
+    }
+    if (header.byte_order != LIRA_BINARY_BYTE_ORDER) {
+      ERROR_EXIT(1, "The binary LIRA model has a different byte order\n");
+    }
+    if (header.file_size != model.get_size()) {
+      ERROR_EXIT2(1, "Wrong binary LIRA model size %lu, expected %lu\n",
+                  (unsigned long)model.get_size(),
+                  (unsigned long)header.file_size);
+    }
+    vocab.reset(new VocabDictionary(model.get_vocab(), header.vocab_bytes));
+    if (vocab->get_vocab_size() != static_cast<unsigned int>(header.vocab_size)) {
+      ERROR_EXIT(1, "Wrong vocabulary size in the binary LIRA model\n");
+    }
+    ngram_order     = header.ngram_order;
+    num_states      = header.num_states;
+    num_transitions = header.num_transitions;
+    initial_state   = header.initial_state;
+    final_state     = header.final_state;
+    lowest_state    = header.lowest_state;
+    max_bound       = header.max_bound;
+    set_end_word(end_ccue);
+    create_arrays(std::vector<LiraBinaryFanOut>(model.get_fan_outs(),
+                                                model.get_fan_outs() +
+                                                header.num_fan_outs));
+    std::vector<int32_t> origins(num_transitions);
+    if (header.quant_bits == 0) {
+      const LiraBinaryState *st = model.get_states();
+      for (int cod=0; cod<num_states; ++cod) {
+        backoff_dest[cod]   = st[cod].backoff_dest;
+        backoff_weight[cod] = st[cod].backoff_weight;
+      }
+      const LiraBinaryTransition *t = model.get_transitions();
+      for (int trans=0; trans<num_transitions; ++trans) {
+        origins[trans] = t[trans].origin;
+        dests[trans]   = t[trans].dest;
+        words[trans]   = t[trans].word;
+        probs[trans]   = t[trans].prob;
+      }
+    }
+    else {
+      const size_t codebook_size = size_t(1u) << header.quant_bits;
+      const float *trans_codebooks   = model.get_codebooks();
+      const float *backoff_codebooks = trans_codebooks + ngram_order*codebook_size;
+      const uint8_t *orders  = model.get_state_orders();
+      const uint8_t *codes8  = static_cast<const uint8_t*>(model.get_state_codes());
+      const uint16_t *codes16 = static_cast<const uint16_t*>(model.get_state_codes());
+      const int state_bits = header.state_bits;
+      const int word_bits  = header.word_bits;
+      if (state_bits < bit_width(num_states) || state_bits > 32 ||
+          word_bits < bit_width(header.vocab_size + 1) || word_bits > 32) {
+        ERROR_EXIT(1, "Wrong bit widths in the binary LIRA model\n");
+      }
+      const uint64_t *packed_backoffs = model.get_backoff_dests();
+      for (int cod=0; cod<num_states; ++cod) {
+        const size_t code = (header.quant_bits == 8) ? codes8[cod] : codes16[cod];
+        backoff_dest[cod]   = lira_binary_column_get(packed_backoffs, cod,
+                                                     state_bits);
+        backoff_weight[cod] = backoff_codebooks[orders[cod]*codebook_size + code];
+      }
+      codes8  = static_cast<const uint8_t*>(model.get_transition_codes());
+      codes16 = static_cast<const uint16_t*>(model.get_transition_codes());
+      const uint64_t *packed_dests = model.get_transition_dests();
+      const uint64_t *packed_words = model.get_transition_words();
+      // origins are not stored, they are given by the first transitions
+      for (int st=0; st<num_states; ++st) {
+        for (uint32_t trans=first[st]; trans<first[st+1]; ++trans) {
+          const size_t code =
+            (header.quant_bits == 8) ? codes8[trans] : codes16[trans];
+          origins[trans] = st;
+          dests[trans] = lira_binary_column_get(packed_dests, trans, state_bits);
+          words[trans] = lira_binary_column_get(packed_words, trans, word_bits);
+          probs[trans]   = trans_codebooks[orders[st]*codebook_size + code];
+        }
+      }
+    }
+    check_transitions(origins.data());
+  }
+
+  // The binary format is detected by its magic, binary files are read in
+  // memory and text files are parsed line by line
+  LiraScorer *LiraScorer::load(const char *filename, const char *end_ccue) {
+    UniquePtr<ArpaInput> input(ArpaInput::open(filename));
+    constString block = input->acquire();
+    if (block.len() == 0) {
+      ERROR_EXIT1(1, "%s is empty\n", filename);
+    }
+    if (block.len() >= sizeof(LiraBinaryHeader) &&
+        memcmp((const char*)block, LIRA_BINARY_MAGIC,
+               sizeof(LIRA_BINARY_MAGIC)) == 0) {
+      LiraBinaryHeader header;
+      memcpy(&header, (const char*)block, sizeof(header));
+      UniquePtr<LiraModel> model(new LiraModel(header.file_size));
+      size_t size = 0u;
+      while (block.len() > 0) {
+        if (size + block.len() > header.file_size) {
+          ERROR_EXIT1(1, "%s is longer than its header says\n", filename);
+        }
+        memcpy(model->get_data() + size, (const char*)block, block.len());
+        size += block.len();
+        input->release();
+        block = input->acquire();
+      }
+      if (size != header.file_size) {
+        ERROR_EXIT1(1, "%s is truncated\n", filename);
+      }
+      return new LiraScorer(*model, end_ccue);
+    }
+    LiraScorer *scorer = new LiraScorer();
+    scorer->load_text(block, input.get());
+    scorer->set_end_word(end_ccue);
+    input->release();
+    return scorer;
+  }
+
+  void LiraScorer::load_text(constString &block, ArpaInput *input) {
+    LiraTextReader reader(block, input);
+    const int vocab_size = reader.next_int();
+    std::vector<char> vocab_words;
+    for (int i=0; i<vocab_size; ++i) {
+      constString word = reader.next_line();
+      vocab_words.insert(vocab_words.end(), (const char*)word,
+                         (const char*)word + word.len());
+      vocab_words.push_back('\0');
+    }
+    vocab.reset(new VocabDictionary(vocab_words.data(), vocab_words.size()));
+    if (vocab->get_vocab_size() != static_cast<unsigned int>(vocab_size)) {
+      ERROR_EXIT(1, "Wrong vocabulary in the LIRA file\n");
+    }
+    ngram_order     = reader.next_int();
+    num_states      = reader.next_int();
+    num_transitions = reader.next_int();
+    constString line = reader.next_data_line();
+    if (!line.extract_float(&max_bound)) {
+      ERROR_EXIT(1, "Expected the bound max trans prob in the LIRA file\n");
+    }
+    
+    std::vector<LiraBinaryFanOut> fan_outs(reader.next_int());
+    for (size_t i=0; i<fan_outs.size(); ++i) {
+      line = reader.next_data_line();
+      if (!line.extract_int(&fan_outs[i].num_states) ||
+          !line.extract_int(&fan_outs[i].fan_out)) {
+        ERROR_EXIT(1, "Wrong fan out line in the LIRA file\n");
+      }
+    }
+    create_arrays(fan_outs);
+    
+    line = reader.next_data_line();
+    if (!line.extract_int(&initial_state) ||
+        !line.extract_int(&final_state) ||
+        !line.extract_int(&lowest_state)) {
+      ERROR_EXIT(1, "Wrong initial, final and lowest states in the LIRA file\n");
+    }
+    for (int i=0; i<num_states; ++i) {
+      int cod, back;
+      float weight;
+      line = reader.next_data_line();
+      if (!line.extract_int(&cod) || !line.extract_int(&back) ||
+          !line.extract_float(&weight) || cod < 0 || cod >= num_states) {
+        ERROR_EXIT(1, "Wrong state line in the LIRA file\n");
+      }
+      backoff_dest[cod]   = back;
+      backoff_weight[cod] = weight;
+    }
+    std::vector<int32_t> origins(num_transitions);
+    for (int trans=0; trans<num_transitions; ++trans) {
+      int origin, dest, word;
+      line = reader.next_data_line();
+      if (!line.extract_int(&origin) || !line.extract_int(&dest) ||
+          !line.extract_int(&word) || !line.extract_float(&probs[trans])) {
+        ERROR_EXIT(1, "Wrong transition line in the LIRA file\n");
+      }
+      origins[trans] = origin;
+      dests[trans]   = dest;
+      words[trans]   = word;
+    }
+    check_transitions(origins.data());
+  }
+
+  // States are coded by increasing fan out, so the first transition of every
+  // state is the number of transitions of the states before it
+  void LiraScorer::create_arrays(const std::vector<LiraBinaryFanOut> &fan_outs) {
+    first.resize(num_states + 1);
+    backoff_dest.assign(num_states, NO_BACKOFF);
+    backoff_weight.assign(num_states, LOG_ZERO);
+    words.resize(num_transitions);
+    dests.resize(num_transitions);
+    probs.resize(num_transitions);
+    int cod = 0;
+    uint32_t trans = 0u;
+    for (size_t i=0; i<fan_outs.size(); ++i) {
+      if (fan_outs[i].num_states < 0 ||
+          fan_outs[i].num_states > num_states - cod) {
+        ERROR_EXIT(1, "The fan outs do not match the number of states\n");
+      }
+      for (int j=0; j<fan_outs[i].num_states; ++j, ++cod) {
+        first[cod] = trans;
+        trans += fan_outs[i].fan_out;
+      }
+    }
+    if (cod != num_states || trans != static_cast<uint32_t>(num_transitions)) {
+      ERROR_EXIT(1, "The fan outs do not match the number of states and "
+                 "transitions\n");
+    }
+    first[num_states] = trans;
+  }
+
+  // Binary search needs every transition in the block of its origin, sorted
+  // by word, and states must be valid
+  void LiraScorer::check_transitions(const int32_t *origins) const {
+    for (int st=0; st<num_states; ++st) {
+      for (uint32_t trans=first[st]; trans<first[st+1]; ++trans) {
+        if (origins[trans] != st ||
+            (trans > first[st] && words[trans-1] >= words[trans])) {
+          ERROR_EXIT1(1, "Transition %u is not sorted by origin and word\n",
+                      trans);
+        }
+        if (dests[trans] < 0 || dests[trans] >= num_states) {
+          ERROR_EXIT1(1, "Wrong destination of transition %u\n", trans);
+        }
+      }
+      if (backoff_dest[st] != NO_BACKOFF &&
+          (backoff_dest[st] < 0 || backoff_dest[st] >= num_states)) {
+        ERROR_EXIT1(1, "Wrong backoff of state %d\n", st);
+      }
+    }
+    if (initial_state < 0 || initial_state >= num_states ||
+        final_state < 0 || final_state >= num_states ||
+        lowest_state < 0 || lowest_state >= num_states) {
+      ERROR_EXIT(1, "Wrong initial, final or lowest state\n");
+    }
+  }
+
+  void LiraScorer::set_end_word(const char *end_ccue) {
+    end_word = (*vocab)(end_ccue);
+    if (end_word == VocabDictionary::UNKNOWN_WORD) {
+      ERROR_EXIT1(1, "End context cue %s not found in the vocabulary\n",
+                  end_ccue);
+    }
+  }
+
+  size_t LiraScorer::get_memory_size() const {
+    return sizeof(uint32_t)*first.size() +
+      (sizeof(int32_t) + sizeof(float))*backoff_dest.size() +
+      (2u*sizeof(int32_t) + sizeof(float))*words.size();
+  }
+  
+  float LiraScorer::score_sentence(const unsigned int *sentence, int n,
+                                   int *num_oovs) const {
+    float logprob = 0.0f;
+    int st = initial_state;
+    int oovs = 0;
+    for (int i=0; i<=n; ++i) {
+      const unsigned int word = (i < n) ? sentence[i] : end_word;
+      float p = LOG_ZERO;
+      if (word != VocabDictionary::UNKNOWN_WORD) {
+        p = score(st, word);
+      }
+      else {
+        st = lowest_state;
+      }
+      if (p <= LOG_ZERO) ++oovs;
+      else logprob += p;
+    }
+    if (num_oovs != 0) *num_oovs = oovs;
+    return logprob;
+  }
+  
+  // Every turn advances each pending query of the group by one step, which
+  // reads data prefetched by its previous step. Long blocks are narrowed by
+  // binary search, one probe per turn, until they are short enough for a
+  // SIMD scan. Backoff weights are added in the same order as score().
+  void LiraScorer::score_batch(int *states, const unsigned int *query_words,
+                               float *logprobs, int n) const {
+    BatchQuery queries[BATCH_SIZE];
+    for (int base=0; base<n; base+=BATCH_SIZE) {
+      const int m = AprilUtils::min(BATCH_SIZE, n - base);
+      for (int i=0; i<m; ++i) {
+        BatchQuery &q = queries[i];
+        q.st      = states[base+i];
+        q.logprob = 0.0f;
+        q.stage   = LOAD_BLOCK;
+        __builtin_prefetch(&first[q.st]);
+      }
+      int pending = m;
+      while (pending > 0) {
+        for (int i=0; i<m; ++i) {
+          BatchQuery &q = queries[i];
+          const int32_t w = static_cast<int32_t>(query_words[base+i]);
+          switch (q.stage) {
+          case LOAD_BLOCK:
+            q.begin = first[q.st];
+            q.end   = first[q.st+1];
+            prefetch_search(words.data(), q.begin, q.end);
+            __builtin_prefetch(&backoff_dest[q.st]);
+            __builtin_prefetch(&backoff_weight[q.st]);
+            q.stage = SEARCH;
+            break;
+          case SEARCH:
+            if (q.end - q.begin > static_cast<uint32_t>(LINEAR_SEARCH_SIZE)) {
+              const uint32_t middle = q.begin + ((q.end - q.begin) >> 1);
+              const int32_t middle_word = words[middle];
+              if (middle_word == w) {
+                q.begin = middle;
+                __builtin_prefetch(&dests[middle]);
+                __builtin_prefetch(&probs[middle]);
+                q.stage = FOUND;
+              }
+              else {
+                if (middle_word < w) q.begin = middle + 1u;
+                else q.end = middle;
+                prefetch_search(words.data(), q.begin, q.end);
+              }
+            }
+            else {
+              const int trans = scan_block(words.data(), q.begin, q.end, w);
+              if (trans >= 0) {
+                q.begin = trans;
+                __builtin_prefetch(&dests[trans]);
+                __builtin_prefetch(&probs[trans]);
+                q.stage = FOUND;
+              }
+              else if (backoff_dest[q.st] == NO_BACKOFF) {
+                q.st      = lowest_state;
+                q.logprob = LOG_ZERO;
+                q.stage   = DONE;
+                --pending;
+              }
+              else {
+                q.logprob += backoff_weight[q.st];
+                q.st = backoff_dest[q.st];
+                __builtin_prefetch(&first[q.st]);
+                q.stage = LOAD_BLOCK;
+              }
+            }
+            break;
+          case FOUND:
+            q.st       = dests[q.begin];
+            q.logprob += probs[q.begin];
+            q.stage    = DONE;
+            --pending;
+            break;
+          case DONE:
+            break;
+          }
+        }
+      }
+      for (int i=0; i<m; ++i) {
+        states[base+i]   = queries[i].st;
+        logprobs[base+i] = queries[i].logprob;
+      }
+    }
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,151 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LIRA_SCORER_H
+#define LIRA_SCORER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "lira_model.h"
+#include "vocab_dictionary.h"
+
+namespace Arpa2Lira {
+
+  class ArpaInput;
+  
+  /// Loads a LIRA model, text or binary, and scores word sequences with it.
+  /// States and transitions are kept in separated arrays indexed by state
+  /// code and by transition. As transitions are sorted by origin and word,
+  /// and states are coded by increasing fan out, the transitions of a state
+  /// are a contiguous block found through the first array, and the
+  /// transition of a word is found by binary search in that block. Words
+  /// without transition are scored by walking the backoff chain.
+  class LiraScorer {
+    AprilUtils::UniquePtr<VocabDictionary> vocab;
+    int ngram_order;
+    int num_states;
+    int num_transitions;
+    int initial_state;
+    int final_state;
+    int lowest_state;
+    float max_bound;
+    unsigned int end_word;
+    
+    std::vector<uint32_t> first; // num_states+1, transitions of every state
+    std::vector<int32_t> backoff_dest;
+    std::vector<float> backoff_weight;
+    std::vector<int32_t> words; // transitions sorted by origin and word
+    std::vector<int32_t> dests;
+    std::vector<float> probs;
+
+    LiraScorer();
+    void load_text(AprilUtils::constString &block, ArpaInput *input);
+    void create_arrays(const std::vector<LiraBinaryFanOut> &fan_outs);
+    void check_transitions(const int32_t *origins) const;
+    void set_end_word(const char *end_ccue);
+    
+  public:
+    static const int NO_BACKOFF = -1;
+    static const float LOG_ZERO;
+    /// Number of queries whose lookups are interleaved by score_batch()
+    static const int BATCH_SIZE = 32;
+    /// Blocks of at most this number of transitions are searched by SIMD
+    /// compares instead of binary search
+    static const int LINEAR_SEARCH_SIZE = 32;
+    
+    /// Builds the arrays from an in-memory binary model
+    LiraScorer(const LiraModel &model, const char *end_ccue = "</s>");
+    /// Loads a text or binary LIRA file, plain or compressed
+    static LiraScorer *load(const char *filename, const char *end_ccue = "</s>");
+
+    const VocabDictionary &get_vocab() const { return *vocab; }
+    int get_ngram_order() const { return ngram_order; }
+    int get_num_states() const { return num_states; }
+    int get_num_transitions() const { return num_transitions; }
+    int get_initial_state() const { return initial_state; }
+    int get_final_state() const { return final_state; }
+    int get_lowest_state() const { return lowest_state; }
+    float get_max_bound() const { return max_bound; }
+    unsigned int get_end_word() const { return end_word; }
+    /// Bytes used by the state and transition arrays
+    size_t get_memory_size() const;
+    
+    /// Returns the transition of the given state and word, or -1
+    int find_transition(int st, unsigned int word) const {
+      const int32_t *begin = words.data() + first[st];
+      const int32_t *end   = words.data() + first[st+1];
+      const int32_t w = static_cast<int32_t>(word);
+      while (begin < end) {
+        const int32_t *middle = begin + ((end - begin) >> 1);
+        if (*middle < w) begin = middle + 1;
+        else end = middle;
+      }
+      return (begin < words.data() + first[st+1] && *begin == w) ?
+        static_cast<int>(begin - words.data()) : -1;
+    }
+
+    /// Log probability (natural log) of word after state st, which is moved
+    /// to the destination state. Unknown words return LOG_ZERO and move st
+    /// to the lowest state.
+    float score(int &st, unsigned int word) const {
+      float logprob = 0.0f;
+      for (;;) {
+        const int trans = find_transition(st, word);
+        if (trans >= 0) {
+          st = dests[trans];
+          return logprob + probs[trans];
+        }
+        const int back = backoff_dest[st];
+        if (back == NO_BACKOFF) {
+          st = lowest_state;
+          return LOG_ZERO;
+        }
+        logprob += backoff_weight[st];
+        st = back;
+      }
+    }
+
+    /// Log probability of a sentence of n word ids followed by the end word,
+    /// starting at the initial state. Words out of the vocabulary
+    /// (VocabDictionary::UNKNOWN_WORD) or the model are not added and are
+    /// counted in num_oovs when it is given. The converter adds the backoff
+    /// weight of states without transitions to the transitions which reach
+    /// them, so a word followed by an unknown one may score lower than with
+    /// the ARPA model.
+    float score_sentence(const unsigned int *sentence, int n,
+                         int *num_oovs = 0) const;
+
+    /// Scores n independent queries, as n calls to score(states[i],
+    /// words[i]) with the results in logprobs[i]. Groups of BATCH_SIZE
+    /// queries advance one memory access at a time in turns, and every
+    /// query prefetches the data of its next step, so the cache misses of
+    /// the group overlap instead of waiting for each other.
+    void score_batch(int *states, const unsigned int *words,
+                     float *logprobs, int n) const;
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // LIRA_SCORER_H
@@ -0,0 +1,370 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <sys/mman.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "config.h"
+#include "lm_arrays.h"
+
+namespace Arpa2Lira {
+
+  namespace {
+    void create_array_buffer(mmapped_file_data &data, size_t bytes) {
+      if (Config::getOutOfCoreMemory() > 0u) {
+        create_file_mmapped_buffer(data, bytes);
+      }
+      else {
+        create_mmapped_buffer(data, bytes);
+      }
+    }
+  } // anonymous namespace
+  
+  void PackedArray::create(size_t n, int width_) {
+    assert(width_ > 0 && width_ <= 32);
+    release();
+    size  = n;
+    width = width_;
+    mask  = (uint64_t(1u) << width) - 1u;
+    create_array_buffer(data, get_words_bytes(n, width));
+    words = (uint64_t*)data.file_mmapped;
+  }
+
+  void PackedArray::map(int fd, size_t offset, size_t n, int width_) {
+    assert(width_ > 0 && width_ <= 32);
+    release();
+    size  = n;
+    width = width_;
+    mask  = (uint64_t(1u) << width) - 1u;
+    map_file_section(data, fd, offset, get_words_bytes(n, width));
+    words = (uint64_t*)data.file_mmapped;
+  }
+
+  void PackedArray::resize(size_t n) {
+    PackedArray other;
+    other.create(n, width);
+    const size_t m = AprilUtils::min(n, size);
+    // whole words are copied, the elements of the last one one by one
+    const size_t num_words = (m * width) / 64u;
+    memcpy(other.words, words, num_words * sizeof(uint64_t));
+    for (size_t i=(num_words * 64u)/width; i<m; ++i) other.set(i, get(i));
+    swap(other);
+  }
+  
+  void PackedArray::advise(int advice) {
+    if (words != 0) advise_mmapped_buffer(data, advice);
+  }
+  
+  void PackedArray::release() {
+    if (words != 0) {
+      release_mmapped_buffer(data);
+      words = 0;
+      size  = 0;
+    }
+  }
+
+  void PackedArray::swap(PackedArray &other) {
+    std::swap(data, other.data);
+    std::swap(words, other.words);
+    std::swap(size, other.size);
+    std::swap(width, other.width);
+    std::swap(mask, other.mask);
+  }
+  
+  ///////////////////////////////////////////////////////////////////////////
+
+  void FloatArray::create(size_t n) {
+    release();
+    size = n;
+    create_array_buffer(data, AprilUtils::max(n, size_t(1u)) * sizeof(float));
+    values = (float*)data.file_mmapped;
+  }
+
+  void FloatArray::map(int fd, size_t offset, size_t n) {
+    release();
+    size = n;
+    map_file_section(data, fd, offset,
+                     AprilUtils::max(n, size_t(1u)) * sizeof(float));
+    values = (float*)data.file_mmapped;
+  }
+
+  void FloatArray::resize(size_t n) {
+    FloatArray other;
+    other.create(n);
+    memcpy(other.values, values, AprilUtils::min(n, size) * sizeof(float));
+    swap(other);
+  }
+
+  void FloatArray::advise(int advice) {
+    if (values != 0) advise_mmapped_buffer(data, advice);
+  }
+
+  void FloatArray::release() {
+    if (values != 0) {
+      release_mmapped_buffer(data);
+      values = 0;
+      size   = 0;
+    }
+  }
+
+  void FloatArray::swap(FloatArray &other) {
+    std::swap(data, other.data);
+    std::swap(values, other.values);
+    std::swap(size, other.size);
+  }
+  
+  ///////////////////////////////////////////////////////////////////////////
+
+  void StateArrays::create(size_t n, int state_bits, int fan_out_bits,
+                           int order_bits) {
+    fan_out.create(n, fan_out_bits);
+    backoff_dest.create(n, state_bits);
+    cod.create(n, state_bits);
+    order.create(n, order_bits);
+    best_prob.create(n);
+    backoff_weight.create(n);
+    // states are looked up by the dictionary while parsing
+    advise(MADV_RANDOM);
+  }
+
+  void StateArrays::advise(int advice) {
+    fan_out.advise(advice);
+    backoff_dest.advise(advice);
+    cod.advise(advice);
+    order.advise(advice);
+    best_prob.advise(advice);
+    backoff_weight.advise(advice);
+  }
+
+  void StateArrays::resize(size_t n) {
+    fan_out.resize(n);
+    backoff_dest.resize(n);
+    cod.resize(n);
+    order.resize(n);
+    best_prob.resize(n);
+    backoff_weight.resize(n);
+    advise(MADV_RANDOM);
+  }
+
+  void StateArrays::swap(StateArrays &other) {
+    fan_out.swap(other.fan_out);
+    backoff_dest.swap(other.backoff_dest);
+    cod.swap(other.cod);
+    order.swap(other.order);
+    best_prob.swap(other.best_prob);
+    backoff_weight.swap(other.backoff_weight);
+  }
+
+  void StateArrays::release() {
+    fan_out.release();
+    backoff_dest.release();
+    cod.release();
+    order.release();
+    best_prob.release();
+    backoff_weight.release();
+  }
+
+  size_t StateArrays::get_bytes() const {
+    return fan_out.get_bytes() + backoff_dest.get_bytes() + cod.get_bytes() +
+      order.get_bytes() + best_prob.get_bytes() + backoff_weight.get_bytes();
+  }
+  
+  void TransitionArrays::create(size_t n, int state_bits, int word_bits) {
+    origin.create(n, state_bits);
+    dest.create(n, state_bits);
+    word.create(n, word_bits);
+    trans_prob.create(n);
+    // transitions are appended and traversed in order
+    origin.advise(MADV_SEQUENTIAL);
+    dest.advise(MADV_SEQUENTIAL);
+    word.advise(MADV_SEQUENTIAL);
+    trans_prob.advise(MADV_SEQUENTIAL);
+  }
+
+  void TransitionArrays::release() {
+    origin.release();
+    dest.release();
+    word.release();
+    trans_prob.release();
+  }
+
+  void TransitionArrays::swap(TransitionArrays &other) {
+    origin.swap(other.origin);
+    dest.swap(other.dest);
+    word.swap(other.word);
+    trans_prob.swap(other.trans_prob);
+  }
+
+  size_t TransitionArrays::get_bytes() const {
+    return origin.get_bytes() + dest.get_bytes() + word.get_bytes() +
+      trans_prob.get_bytes();
+  }
+  
+  ///////////////////////////////////////////////////////////////////////////
+
+  namespace {
+    // Splits [0,n) into one range per thread, with limits multiple of 64, and
+    // runs f(begin,end,parallel) for every range with parallel_for.
+    template<typename F>
+    void parallel_ranges(size_t n, F f) {
+      const size_t MIN_RANGE_SIZE = 65536u;
+      size_t num_parts = AprilUtils::min(size_t(Config::getNumberOfThreads()),
+                                         n / MIN_RANGE_SIZE);
+      if (num_parts <= 1u) {
+        f(size_t(0u), n, false);
+        return;
+      }
+      const size_t range_size = ((n + num_parts - 1u) / num_parts + 63u) & ~size_t(63u);
+      Config::thread_pool->parallel_for(0u, n, range_size,
+                                        [&f](size_t begin, size_t end) {
+                                          f(begin, end, true);
+                                        });
+    }
+
+    // elements of the range [begin,end) which may share a packed word with
+    // elements out of it are those below first_packed_end(begin) or above
+    // last_packed_begin(end), computed over the narrowest column
+    size_t packed_margin(const TransitionArrays &arrays) {
+      int width = AprilUtils::min(arrays.origin.get_width(),
+                                  arrays.word.get_width());
+      return (64u + width - 1u) / width;
+    }
+    
+    size_t first_packed_end(const TransitionArrays &arrays, size_t begin) {
+      return begin + packed_margin(arrays);
+    }
+
+    size_t last_packed_begin(const TransitionArrays &arrays, size_t end) {
+      size_t margin = packed_margin(arrays);
+      return (end < margin) ? 0u : end - margin;
+    }
+
+    // Scatters every run of transitions with the same origin to the next free
+    // positions of its origin block, only the first and last packed words of
+    // a run may be shared with other threads
+    void scatter_by_runs(const TransitionArrays &input, size_t n,
+                         const int *first, int num_origins,
+                         TransitionArrays &output) {
+      std::vector<int> next(first, first + num_origins);
+      parallel_ranges(n, [&](size_t begin, size_t end, bool parallel) {
+          size_t i = begin;
+          while (i < end) {
+            const int o = input.origin.get(i);
+            size_t run_end = i + 1;
+            while (run_end < end && input.origin.get(run_end) == o) ++run_end;
+            if (o < 0 || o >= num_origins) { // discarded
+              i = run_end;
+              continue;
+            }
+            const size_t len = run_end - i;
+            size_t pos;
+            if (parallel) {
+              pos = __atomic_fetch_add(&next[o], static_cast<int>(len),
+                                       __ATOMIC_RELAXED);
+            }
+            else {
+              pos = next[o];
+              next[o] += len;
+            }
+            const size_t pos_end = pos + len;
+            for (; i<run_end; ++i, ++pos) {
+              const bool shared = parallel &&
+                (pos < first_packed_end(output, pos_end - len) ||
+                 pos >= last_packed_begin(output, pos_end));
+              if (shared) {
+                output.origin.set_zero_atomic(pos, o);
+                output.dest.set_zero_atomic(pos, input.dest.get(i));
+                output.word.set_zero_atomic(pos, input.word.get(i));
+              }
+              else {
+                output.origin.set(pos, o);
+                output.dest.set(pos, input.dest.get(i));
+                output.word.set(pos, input.word.get(i));
+              }
+              output.trans_prob[pos] = input.trans_prob[i];
+            }
+          }
+        });
+    }
+
+    struct BlockEntry {
+      int word;
+      int dest;
+      float trans_prob;
+      bool operator<(const BlockEntry &other) const {
+        return word < other.word;
+      }
+    };
+  } // anonymous namespace
+  
+  void sort_transitions_by_origin(const TransitionArrays &input, size_t n,
+                                  const int *first, int num_origins,
+                                  TransitionArrays &output) {
+    scatter_by_runs(input, n, first, num_origins, output);
+    // sort every origin block by word; a thread owns the blocks which start in
+    // its range, words shared with other threads are written atomically
+    const size_t total = first[num_origins];
+    parallel_ranges(total, [&](size_t begin, size_t end, bool parallel) {
+        const int o_begin = std::lower_bound(first, first + num_origins,
+                                             static_cast<int>(begin)) - first;
+        const int o_end   = std::lower_bound(first, first + num_origins,
+                                             static_cast<int>(end)) - first;
+        const size_t r0 = first[o_begin], r1 = first[o_end];
+        std::vector<BlockEntry> block;
+        for (int o=o_begin; o<o_end; ++o) {
+          const size_t b = first[o], e = first[o+1];
+          bool sorted = true;
+          for (size_t i=b+1; i<e && sorted; ++i) {
+            sorted = output.word.get(i-1) <= output.word.get(i);
+          }
+          if (sorted) continue;
+          block.resize(e - b);
+          for (size_t i=b; i<e; ++i) {
+            block[i-b].word       = output.word.get(i);
+            block[i-b].dest       = output.dest.get(i);
+            block[i-b].trans_prob = output.trans_prob[i];
+          }
+          std::sort(block.begin(), block.end());
+          for (size_t i=b; i<e; ++i) {
+            const bool shared = parallel &&
+              ( (i & ~size_t(63u)) < r0 || (i | size_t(63u)) >= r1 );
+            if (shared) {
+              output.word.set_atomic(i, block[i-b].word);
+              output.dest.set_atomic(i, block[i-b].dest);
+            }
+            else {
+              output.word.set(i, block[i-b].word);
+              output.dest.set(i, block[i-b].dest);
+            }
+            output.trans_prob[i] = block[i-b].trans_prob;
+          }
+        }
+      });
+  }
+  
+} // namespace Arpa2Lira
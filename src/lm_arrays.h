@@ -0,0 +1,207 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LM_ARRAYS_H
+#define LM_ARRAYS_H
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+
+// from Arpa2Lira
+#include "mmapped_file.h"
+
+namespace Arpa2Lira {
+
+  /// Number of bits needed to represent x
+  inline int bit_width(uint64_t x) {
+    return (x == 0u) ? 0 : 64 - __builtin_clzll(x);
+  }
+
+  /// Array of integers with a fixed number of bits, packed in 64 bit words
+  /// stored in an anonymous mmap (zero-initialized). The value with all bits
+  /// set is reserved to represent -1. Every 64 consecutive elements use their
+  /// own words, so threads working on ranges aligned to 64 elements never
+  /// share a word.
+  class PackedArray {
+    mmapped_file_data data;
+    uint64_t *words;
+    size_t size;
+    int width;
+    uint64_t mask;
+
+    PackedArray(const PackedArray &);
+    PackedArray &operator=(const PackedArray &);
+
+    static uint64_t encode(int v, uint64_t mask) {
+      return static_cast<uint64_t>(static_cast<uint32_t>(v)) & mask;
+    }
+    
+  public:
+    PackedArray() : words(0), size(0), width(0), mask(0) { }
+    ~PackedArray() { release(); }
+    void create(size_t n, int width);
+    /// Maps n elements written by get_words() at the given offset of a file,
+    /// see map_file_section()
+    void map(int fd, size_t offset, size_t n, int width);
+    /// Changes the size keeping the first elements, new ones are zero
+    void resize(size_t n);
+    /// Gives the kernel an madvise() hint about the access pattern
+    void advise(int advice);
+    void release();
+    void swap(PackedArray &other);
+    
+    size_t get_size() const { return size; }
+    int get_width() const { return width; }
+    size_t get_bytes() const { return (words == 0) ? 0u : data.file_size; }
+    /// Bytes of the words which store n elements of the given width
+    static size_t get_words_bytes(size_t n, int width) {
+      // one extra word allows to read words[w+1] at the end
+      return ((n * width + 63u) / 64u + 1u) * sizeof(uint64_t);
+    }
+    const uint64_t *get_words() const { return words; }
+    
+    int get(size_t i) const {
+      const size_t bit = i * width;
+      const size_t w = bit >> 6;
+      const unsigned int off = bit & 63u;
+      uint64_t x = words[w] >> off;
+      if (off + width > 64u) x |= words[w+1] << (64u - off);
+      x &= mask;
+      return (x == mask) ? -1 : static_cast<int>(x);
+    }
+
+    void set(size_t i, int v) {
+      assert(v == -1 || static_cast<uint64_t>(v) < mask);
+      const uint64_t x = encode(v, mask);
+      const size_t bit = i * width;
+      const size_t w = bit >> 6;
+      const unsigned int off = bit & 63u;
+      words[w] = (words[w] & ~(mask << off)) | (x << off);
+      if (off + width > 64u) {
+        const unsigned int s = 64u - off;
+        words[w+1] = (words[w+1] & ~(mask >> s)) | (x >> s);
+      }
+    }
+
+    /// Same as set() for elements whose words may be written by other threads
+    void set_atomic(size_t i, int v) {
+      assert(v == -1 || static_cast<uint64_t>(v) < mask);
+      const uint64_t x = encode(v, mask);
+      const size_t bit = i * width;
+      const size_t w = bit >> 6;
+      const unsigned int off = bit & 63u;
+      __atomic_fetch_and(&words[w], ~(mask << off), __ATOMIC_RELAXED);
+      __atomic_fetch_or(&words[w], x << off, __ATOMIC_RELAXED);
+      if (off + width > 64u) {
+        const unsigned int s = 64u - off;
+        __atomic_fetch_and(&words[w+1], ~(mask >> s), __ATOMIC_RELAXED);
+        __atomic_fetch_or(&words[w+1], x >> s, __ATOMIC_RELAXED);
+      }
+    }
+
+    /// Thread-safe set() of an element which is still zero
+    void set_zero_atomic(size_t i, int v) {
+      assert(v == -1 || static_cast<uint64_t>(v) < mask);
+      const uint64_t x = encode(v, mask);
+      const size_t bit = i * width;
+      const size_t w = bit >> 6;
+      const unsigned int off = bit & 63u;
+      __atomic_fetch_or(&words[w], x << off, __ATOMIC_RELAXED);
+      if (off + width > 64u) {
+        __atomic_fetch_or(&words[w+1], x >> (64u - off), __ATOMIC_RELAXED);
+      }
+    }
+  };
+
+  /// Array of floats stored in an anonymous mmap (zero-initialized)
+  class FloatArray {
+    mmapped_file_data data;
+    float *values;
+    size_t size;
+
+    FloatArray(const FloatArray &);
+    FloatArray &operator=(const FloatArray &);
+    
+  public:
+    FloatArray() : values(0), size(0) { }
+    ~FloatArray() { release(); }
+    void create(size_t n);
+    /// Maps n floats at the given offset of a file, see map_file_section()
+    void map(int fd, size_t offset, size_t n);
+    void resize(size_t n);
+    void advise(int advice);
+    void release();
+    void swap(FloatArray &other);
+
+    size_t get_size() const { return size; }
+    size_t get_bytes() const { return (values == 0) ? 0u : data.file_size; }
+    float *get() { return values; }
+    const float *get() const { return values; }
+    float &operator[](size_t i) { return values[i]; }
+    const float &operator[](size_t i) const { return values[i]; }
+  };
+
+  /// States as a structure of arrays, state ids are packed to the bits needed
+  /// by the maximum number of states. They are created and resized with the
+  /// MADV_RANDOM hint, as they are randomly accessed while parsing.
+  struct StateArrays {
+    PackedArray fan_out;
+    PackedArray backoff_dest; // no backoff is stored as -1
+    PackedArray cod;          // the final code in lira format
+    PackedArray order;        // length of the n-gram context of the state
+    FloatArray  best_prob;
+    FloatArray  backoff_weight;
+    
+    void create(size_t n, int state_bits, int fan_out_bits, int order_bits);
+    void resize(size_t n);
+    void advise(int advice);
+    void swap(StateArrays &other);
+    void release();
+    size_t get_bytes() const;
+  };
+
+  /// Transitions as a structure of arrays, state ids and words are packed to
+  /// the bits needed by the maximum number of states and vocabulary size. All
+  /// the passes over them are sequential, which is advised to the kernel.
+  struct TransitionArrays {
+    PackedArray origin;
+    PackedArray dest;
+    PackedArray word;
+    FloatArray  trans_prob;
+
+    void create(size_t n, int state_bits, int word_bits);
+    void release();
+    void swap(TransitionArrays &other);
+    size_t get_bytes() const;
+  };
+
+  /// Moves the first n transitions of input whose origin is in the range
+  /// [0,num_origins) into output, sorted by origin and word. first has
+  /// num_origins+1 elements, first[o] is the position in output of the first
+  /// transition of origin o. Output must be zero-initialized. Transitions are
+  /// scattered to their origin blocks and every block is sorted by word, both
+  /// steps run in Config::thread_pool.
+  void sort_transitions_by_origin(const TransitionArrays &input, size_t n,
+                                  const int *first, int num_origins,
+                                  TransitionArrays &output);
+  
+} // namespace Arpa2Lira
+
+#endif // LM_ARRAYS_H
@@ -0,0 +1,294 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "binarize_arpa.h"
+#include "config.h"
+#include "lira_model.h"
+
+// Lua module arpa2lira, loaded by APRIL with require "arpa2lira":
+//
+//   model = arpa2lira.convert(vocab_filename, arpa_filename,
+//                             { threads=4, quant_bits=8, low_memory=true })
+//   -- prune_prob (log10) and prune_entropy options enable pruning
+//   model = arpa2lira.convert(vocab_filename, { arpa1, arpa2 },
+//                             { weights={ 0.7, 0.3 } })
+//   -- linear interpolation of several ARPA models, equal weights by default
+//   -- the snapshot option writes the parsed model to the given file, and
+//   model = arpa2lira.resume(snapshot_filename, { quant_bits=16 })
+//   -- generates another model from it without parsing the ARPA files
+//   model:header()       -- table with the fields of LiraBinaryHeader
+//   model:size()         -- bytes of the binary model
+//   model:write(filename)
+//   model:data()         -- light userdata, owned by the model
+//   model:release()      -- light userdata and size, owned by the caller
+//
+// The model is the binary LIRA format of lira_binary.h in memory, so C++
+// code of APRIL adopts the released buffer and frees it with free().
+
+using namespace Arpa2Lira;
+
+namespace {
+  const char *MODEL_METATABLE = "arpa2lira.model";
+
+  LiraModel *&check_model(lua_State *L) {
+    LiraModel **ud = static_cast<LiraModel**>(luaL_checkudata(L, 1,
+                                                               MODEL_METATABLE));
+    if (*ud == 0) luaL_error(L, "The model has been released");
+    return *ud;
+  }
+
+  int get_int_field(lua_State *L, int table, const char *name, int def) {
+    lua_getfield(L, table, name);
+    int result = luaL_optint(L, -1, def);
+    lua_pop(L, 1);
+    return result;
+  }
+
+  double get_number_field(lua_State *L, int table, const char *name,
+                          double def) {
+    lua_getfield(L, table, name);
+    double result = luaL_optnumber(L, -1, def);
+    lua_pop(L, 1);
+    return result;
+  }
+
+  const char *get_string_field(lua_State *L, int table, const char *name,
+                               const char *def) {
+    lua_getfield(L, table, name);
+    const char *result = luaL_optstring(L, -1, def);
+    lua_pop(L, 1);
+    return result; // the string is kept alive by the table
+  }
+
+  // Numbers or strings of the array part of a table, kept alive by it
+  void get_number_array(lua_State *L, int table, std::vector<float> &v) {
+    for (int i=1; i<=static_cast<int>(lua_rawlen(L, table)); ++i) {
+      lua_rawgeti(L, table, i);
+      v.push_back(luaL_checknumber(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+
+  void get_string_array(lua_State *L, int table, std::vector<const char*> &v) {
+    for (int i=1; i<=static_cast<int>(lua_rawlen(L, table)); ++i) {
+      lua_rawgeti(L, table, i);
+      v.push_back(luaL_checkstring(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  
+  /// Options of the LIRA generation, shared by convert and resume
+  struct GenerateOptions {
+    int threads, quant_bits;
+    bool low_memory;
+    double prune_prob, prune_entropy;
+
+    GenerateOptions() : threads(Config::getNumberOfThreads()), quant_bits(0),
+                        low_memory(false), prune_prob(-99.0),
+                        prune_entropy(0.0) { }
+  };
+
+  void get_generate_options(lua_State *L, int table, GenerateOptions &opts) {
+    opts.threads    = get_int_field(L, table, "threads", opts.threads);
+    opts.quant_bits = get_int_field(L, table, "quant_bits", 0);
+    lua_getfield(L, table, "low_memory");
+    opts.low_memory = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    opts.prune_prob    = get_number_field(L, table, "prune_prob",
+                                          opts.prune_prob);
+    opts.prune_entropy = get_number_field(L, table, "prune_entropy",
+                                          opts.prune_entropy);
+  }
+
+  void set_threads(lua_State *L, const GenerateOptions &opts) {
+    if (opts.threads < 1) luaL_error(L, "threads must be positive");
+    if (static_cast<unsigned int>(opts.threads) !=
+        Config::getNumberOfThreads()) {
+      Config::setNumberOfThreads(opts.threads);
+    }
+  }
+
+  // Pushes the model userdata before generating it, so it is collected if
+  // the generation fails
+  LiraModel **push_model(lua_State *L) {
+    LiraModel **ud = static_cast<LiraModel**>(lua_newuserdata(L, sizeof(LiraModel*)));
+    *ud = 0;
+    luaL_setmetatable(L, MODEL_METATABLE);
+    return ud;
+  }
+
+  void set_generate_options(BinarizeArpa &obj, const GenerateOptions &opts) {
+    obj.set_quantization_bits(opts.quant_bits);
+    obj.set_low_memory(opts.low_memory);
+    obj.set_probability_threshold(opts.prune_prob);
+    obj.set_entropy_threshold(opts.prune_entropy);
+  }
+  
+  int convert(lua_State *L) {
+    const char *vocab_filename = luaL_checkstring(L, 1);
+    std::vector<const char*> arpa_filenames;
+    std::vector<float> weights;
+    if (lua_type(L, 2) == LUA_TTABLE) {
+      get_string_array(L, 2, arpa_filenames);
+    }
+    else {
+      arpa_filenames.push_back(luaL_checkstring(L, 2));
+    }
+    GenerateOptions opts;
+    const char *begin_ccue = "<s>", *end_ccue = "</s>";
+    const char *snapshot_filename = 0;
+    if (!lua_isnoneornil(L, 3)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      get_generate_options(L, 3, opts);
+      begin_ccue = get_string_field(L, 3, "begin_ccue", begin_ccue);
+      end_ccue   = get_string_field(L, 3, "end_ccue", end_ccue);
+      snapshot_filename = get_string_field(L, 3, "snapshot", 0);
+      lua_getfield(L, 3, "weights");
+      if (!lua_isnil(L, -1)) {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        get_number_array(L, lua_gettop(L), weights);
+      }
+      lua_pop(L, 1);
+    }
+    if (arpa_filenames.empty()) luaL_error(L, "No ARPA filename given");
+    if (weights.empty()) weights.assign(arpa_filenames.size(), 1.0f);
+    if (weights.size() != arpa_filenames.size()) {
+      luaL_error(L, "Every ARPA filename needs a weight");
+    }
+    for (size_t i=0; i<weights.size(); ++i) {
+      if (!(weights[i] > 0.0f)) luaL_error(L, "weights must be positive");
+    }
+    set_threads(L, opts);
+    LiraModel **ud = push_model(L);
+    BinarizeArpa obj(vocab_filename, arpa_filenames, weights,
+                     begin_ccue, end_ccue);
+    set_generate_options(obj, opts);
+    obj.processArpa();
+    if (snapshot_filename != 0) obj.write_snapshot(snapshot_filename);
+    *ud = obj.generate_lira_model();
+    return 1;
+  }
+
+  int resume(lua_State *L) {
+    const char *snapshot_filename = luaL_checkstring(L, 1);
+    GenerateOptions opts;
+    if (!lua_isnoneornil(L, 2)) {
+      luaL_checktype(L, 2, LUA_TTABLE);
+      get_generate_options(L, 2, opts);
+    }
+    set_threads(L, opts);
+    LiraModel **ud = push_model(L);
+    BinarizeArpa obj(snapshot_filename);
+    set_generate_options(obj, opts);
+    *ud = obj.generate_lira_model();
+    return 1;
+  }
+
+  int model_header(lua_State *L) {
+    const LiraBinaryHeader &header = check_model(L)->get_header();
+    lua_newtable(L);
+#define SET_FIELD(name) do {                            \
+      lua_pushnumber(L, static_cast<lua_Number>(header.name));  \
+      lua_setfield(L, -2, #name);                       \
+    } while(0)
+    SET_FIELD(version);
+    SET_FIELD(vocab_size);
+    SET_FIELD(ngram_order);
+    SET_FIELD(num_states);
+    SET_FIELD(num_transitions);
+    SET_FIELD(initial_state);
+    SET_FIELD(final_state);
+    SET_FIELD(lowest_state);
+    SET_FIELD(num_fan_outs);
+    SET_FIELD(max_bound);
+    SET_FIELD(quant_bits);
+    SET_FIELD(file_size);
+#undef SET_FIELD
+    return 1;
+  }
+
+  int model_size(lua_State *L) {
+    lua_pushnumber(L, static_cast<lua_Number>(check_model(L)->get_size()));
+    return 1;
+  }
+
+  int model_write(lua_State *L) {
+    LiraModel *model = check_model(L);
+    model->write(luaL_checkstring(L, 2));
+    return 0;
+  }
+
+  int model_data(lua_State *L) {
+    lua_pushlightuserdata(L, check_model(L)->get_data());
+    return 1;
+  }
+
+  int model_release(lua_State *L) {
+    LiraModel *&model = check_model(L);
+    size_t size = model->get_size();
+    lua_pushlightuserdata(L, model->release());
+    lua_pushnumber(L, static_cast<lua_Number>(size));
+    delete model;
+    model = 0;
+    return 2;
+  }
+
+  int model_gc(lua_State *L) {
+    LiraModel **ud = static_cast<LiraModel**>(luaL_checkudata(L, 1,
+                                                               MODEL_METATABLE));
+    delete *ud;
+    *ud = 0;
+    return 0;
+  }
+
+  const luaL_Reg model_methods[] = {
+    { "header",  model_header },
+    { "size",    model_size },
+    { "write",   model_write },
+    { "data",    model_data },
+    { "release", model_release },
+    { 0, 0 }
+  };
+
+  const luaL_Reg functions[] = {
+    { "convert", convert },
+    { "resume",  resume },
+    { 0, 0 }
+  };
+} // anonymous namespace
+
+extern "C" int luaopen_arpa2lira(lua_State *L) {
+  luaL_newmetatable(L, MODEL_METATABLE);
+  luaL_newlib(L, model_methods);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, model_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  luaL_newlib(L, functions);
+  return 1;
+}
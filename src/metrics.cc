@@ -0,0 +1,148 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+}
+
+#include <cassert>
+#include <cstdio>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "config.h"
+#include "metrics.h"
+
+namespace Arpa2Lira {
+
+  namespace {
+    double rate(uint64_t n, double seconds) {
+      return (seconds > 0.0) ? n / seconds : 0.0;
+    }
+    
+    void write_phase(FILE *f, const Metrics::Phase &p, const char *indent) {
+      fprintf(f, "%s\"name\": \"%s\",\n", indent, p.name.c_str());
+      fprintf(f, "%s\"wall_time\": %.6f,\n", indent, p.wall_time);
+      fprintf(f, "%s\"cpu_time\": %.6f,\n", indent, p.cpu_time);
+      fprintf(f, "%s\"items\": %llu,\n", indent, (unsigned long long)p.items);
+      fprintf(f, "%s\"bytes\": %llu,\n", indent, (unsigned long long)p.bytes);
+      fprintf(f, "%s\"items_per_second\": %.1f,\n", indent,
+              rate(p.items, p.wall_time));
+      fprintf(f, "%s\"bytes_per_second\": %.1f,\n", indent,
+              rate(p.bytes, p.wall_time));
+      fprintf(f, "%s\"minor_faults\": %llu,\n", indent,
+              (unsigned long long)p.minor_faults);
+      fprintf(f, "%s\"major_faults\": %llu,\n", indent,
+              (unsigned long long)p.major_faults);
+      fprintf(f, "%s\"max_rss_mb\": %.1f\n", indent, p.max_rss);
+    }
+  }
+  
+  Metrics::Metrics() : start_wall(0.0), start_cpu(0.0),
+                       start_minor_faults(0u), start_major_faults(0u) {
+    creation_wall = get_wall_time();
+    creation_cpu  = get_cpu_time();
+    get_page_faults(creation_minor_faults, creation_major_faults);
+  }
+
+  void Metrics::begin(const char *name) {
+    assert(current.empty() && "Unfinished metrics phase");
+    current = name;
+    start_wall = get_wall_time();
+    start_cpu  = get_cpu_time();
+    get_page_faults(start_minor_faults, start_major_faults);
+  }
+
+  void Metrics::end(uint64_t items, uint64_t bytes) {
+    assert(!current.empty() && "Metrics phase not started");
+    Phase p;
+    p.name      = current;
+    p.wall_time = get_wall_time() - start_wall;
+    p.cpu_time  = get_cpu_time() - start_cpu;
+    p.items     = items;
+    p.bytes     = bytes;
+    p.max_rss   = get_max_rss();
+    get_page_faults(p.minor_faults, p.major_faults);
+    p.minor_faults -= start_minor_faults;
+    p.major_faults -= start_major_faults;
+    phases.push_back(p);
+    current.clear();
+  }
+
+  void Metrics::write_json(const char *filename) const {
+    FILE *f = fopen(filename, "w");
+    if (f == 0) {
+      ERROR_EXIT1(1, "Unable to open metrics file %s\n", filename);
+    }
+    Phase total;
+    total.name      = "total";
+    total.wall_time = get_wall_time() - creation_wall;
+    total.cpu_time  = get_cpu_time() - creation_cpu;
+    total.items     = 0u;
+    total.bytes     = 0u;
+    total.max_rss   = get_max_rss();
+    get_page_faults(total.minor_faults, total.major_faults);
+    total.minor_faults -= creation_minor_faults;
+    total.major_faults -= creation_major_faults;
+    fprintf(f, "{\n  \"threads\": %u,\n  \"phases\": [\n",
+            Config::getNumberOfThreads());
+    for (size_t i=0; i<phases.size(); ++i) {
+      fprintf(f, "    {\n");
+      write_phase(f, phases[i], "      ");
+      fprintf(f, "    }%s\n", (i+1 < phases.size()) ? "," : "");
+    }
+    fprintf(f, "  ],\n  \"total\": {\n");
+    write_phase(f, total, "    ");
+    fprintf(f, "  }\n}\n");
+    if (fclose(f) != 0) {
+      ERROR_EXIT1(1, "Unable to write metrics file %s\n", filename);
+    }
+  }
+
+  double Metrics::get_wall_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+  double Metrics::get_cpu_time() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+  }
+  
+  void Metrics::get_page_faults(uint64_t &minor, uint64_t &major) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    minor = usage.ru_minflt;
+    major = usage.ru_majflt;
+  }
+  
+  double Metrics::get_max_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0; // ru_maxrss is given in KB
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,79 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Arpa2Lira {
+
+  /// Records wall and CPU time, processed items and bytes, page faults and the
+  /// RSS high-water mark of consecutive phases of the conversion. CPU time is
+  /// the user plus system time of the whole process, so it includes the
+  /// thread pool, and the RSS is the peak reached until the end of the phase.
+  class Metrics {
+  public:
+    struct Phase {
+      std::string name;
+      double wall_time; // seconds
+      double cpu_time;  // seconds
+      uint64_t items;
+      uint64_t bytes;
+      uint64_t minor_faults; // page faults served without I/O
+      uint64_t major_faults; // page faults which needed I/O
+      double max_rss; // MB
+    };
+
+  private:
+    std::vector<Phase> phases;
+    std::string current;
+    double start_wall, start_cpu;
+    uint64_t start_minor_faults, start_major_faults;
+    double creation_wall, creation_cpu;
+    uint64_t creation_minor_faults, creation_major_faults;
+
+  public:
+    Metrics();
+    
+    /// Starts a phase, the previous one must have been finished
+    void begin(const char *name);
+    /// Finishes the current phase with the number of items (n-grams, states,
+    /// transitions) and bytes it has processed
+    void end(uint64_t items, uint64_t bytes = 0u);
+
+    const std::vector<Phase> &get_phases() const { return phases; }
+
+    /// Writes the phases and their totals as a JSON object
+    void write_json(const char *filename) const;
+    
+    static double get_wall_time();
+    static double get_cpu_time();
+    /// Returns the RSS high-water mark of the process in MB
+    static double get_max_rss();
+    /// Page faults of the process since it started
+    static void get_page_faults(uint64_t &minor, uint64_t &major);
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // METRICS_H
@@ -0,0 +1,184 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>           // mmap() is defined in this header
+#include <unistd.h>
+}
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "config.h"
+#include "mmapped_file.h"
+
+namespace Arpa2Lira {
+
+  namespace {
+    const size_t PAGE_SIZE      = 4096u;
+    const size_t HUGE_PAGE_SIZE = 2u<<20;
+
+    // Writes a zero into every page, the buffer is still zero-filled
+    void prefault_pages(char *buffer, size_t size) {
+      for (size_t pos=0; pos<size; pos+=PAGE_SIZE) {
+        *static_cast<volatile char*>(buffer + pos) = 0;
+      }
+    }
+    
+    void prefault_parallel(char *buffer, size_t size) {
+      const size_t num_pages = (size + PAGE_SIZE - 1u) / PAGE_SIZE;
+      const size_t grain = HUGE_PAGE_SIZE / PAGE_SIZE;
+      Config::thread_pool->parallel_for(0u, num_pages, grain,
+                                        [buffer](size_t begin, size_t end) {
+          for (size_t page=begin; page<end; ++page) {
+            *static_cast<volatile char*>(buffer + page*PAGE_SIZE) = 0;
+          }
+        });
+    }
+  } // anonymous namespace
+  
+  // Private anonymous mappings are needed by transparent huge pages, explicit
+  // huge pages fall back to normal ones when no huge page is reserved
+  void create_mmapped_buffer(mmapped_file_data &filedata, size_t filesize) {
+    static bool hugetlb_warning = false;
+    filedata.file_descriptor = -1;
+    filedata.file_size       = filesize;
+    // small buffers use normal pages
+    const bool huge = (Config::getHugePages() != Config::HUGE_PAGES_NONE &&
+                       filesize >= HUGE_PAGE_SIZE);
+    const int populate = (Config::getPrefault() == Config::PREFAULT_POPULATE) ?
+      MAP_POPULATE : 0;
+    int flags = MAP_ANON | MAP_PRIVATE;
+    // MAP_POPULATE would fault normal pages before madvise(MADV_HUGEPAGE)
+    if (!huge) {
+      flags |= populate;
+    }
+    filedata.file_mmapped = (char*)MAP_FAILED;
+    if (huge && Config::getHugePages() == Config::HUGE_PAGES_EXPLICIT) {
+      // the length of huge pages mappings is a multiple of their size
+      size_t hugesize = (filesize + HUGE_PAGE_SIZE - 1u) & ~(HUGE_PAGE_SIZE - 1u);
+      filedata.file_mmapped = (char*)mmap(NULL, hugesize, PROT_READ | PROT_WRITE,
+                                          flags | MAP_HUGETLB | populate, -1, 0);
+      if (filedata.file_mmapped != MAP_FAILED) {
+        filedata.file_size = hugesize;
+      }
+      else if (!hugetlb_warning) {
+        ERROR_PRINT1("Unable to use explicit huge pages, using normal pages: %s\n",
+                     strerror(errno));
+        hugetlb_warning = true;
+      }
+    }
+    if (filedata.file_mmapped == MAP_FAILED) {
+      if ((filedata.file_mmapped = (char*)mmap(NULL, filesize,
+                                               PROT_READ | PROT_WRITE, flags,
+                                               -1, 0)) == MAP_FAILED) {
+        ERROR_EXIT2(1, "Error creating anonymous mmap of size %lu: %s\n",
+                    filesize, strerror(errno));
+      }
+      if (huge) {
+        advise_mmapped_buffer(filedata, MADV_HUGEPAGE);
+        if (Config::getPrefault() == Config::PREFAULT_POPULATE) {
+#ifdef MADV_POPULATE_WRITE
+          if (madvise(filedata.file_mmapped, filesize, MADV_POPULATE_WRITE) != 0)
+#endif
+            prefault_pages(filedata.file_mmapped, filesize);
+        }
+      }
+    }
+    if (Config::getPrefault() == Config::PREFAULT_PARALLEL) {
+      prefault_parallel(filedata.file_mmapped, filedata.file_size);
+    }
+  }
+
+  // The temporary file is unlinked once mapped, so its blocks are returned to
+  // the file system when the buffer is released or the process dies
+  void create_file_mmapped_buffer(mmapped_file_data &filedata,
+                                  size_t filesize) {
+    AprilUtils::UniquePtr<char []> filename;
+    filedata.file_descriptor = Config::openTemporaryFile(O_CLOEXEC, filename);
+    if (filedata.file_descriptor < 0) {
+      ERROR_EXIT1(1, "Error creating temporary file: %s\n", strerror(errno));
+    }
+    filedata.file_size = filesize;
+    if (ftruncate(filedata.file_descriptor, filesize) != 0) {
+      ERROR_EXIT3(1, "Error resizing temporary file %s to %lu bytes: %s\n",
+                  filename.get(), filesize, strerror(errno));
+    }
+    if ((filedata.file_mmapped = (char*)mmap(NULL, filesize,
+                                             PROT_READ | PROT_WRITE, MAP_SHARED,
+                                             filedata.file_descriptor, 0)) == MAP_FAILED) {
+      ERROR_EXIT3(1, "Error mmapping temporary file %s of size %lu: %s\n",
+                  filename.get(), filesize, strerror(errno));
+    }
+    unlink(filename.get());
+  }
+
+  void read_mmapped_buffer(mmapped_file_data &filedata, const char *filename) {
+    // open file
+    filedata.file_descriptor = -1;
+    assert((filedata.file_descriptor = open(filename, O_RDONLY)) >= 0);
+    // find size of input file
+    struct stat statbuf;
+    assert(fstat(filedata.file_descriptor,&statbuf) >= 0);
+    filedata.file_size = statbuf.st_size;
+    // mmap the input file
+    if ((filedata.file_mmapped = (char*)mmap(NULL, filedata.file_size,
+                                             PROT_READ, MAP_SHARED,
+                                             filedata.file_descriptor, 0)) == MAP_FAILED) {
+      ERROR_EXIT2(1, "Error reading mmapped file %s: %s\n",
+                  filename, strerror(errno));
+    }
+  }
+  
+  // The mapping keeps its own reference to the file, so the descriptor is
+  // not owned by the buffer
+  void map_file_section(mmapped_file_data &filedata, int fd,
+                        size_t offset, size_t size) {
+    filedata.file_descriptor = -1;
+    filedata.file_size       = size;
+    if ((filedata.file_mmapped = (char*)mmap(NULL, size,
+                                             PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                                             fd, offset)) == MAP_FAILED) {
+      ERROR_EXIT3(1, "Error mmapping %lu bytes at offset %lu: %s\n",
+                  size, offset, strerror(errno));
+    }
+  }
+  
+  void advise_mmapped_buffer(mmapped_file_data &filedata, int advice) {
+    madvise(filedata.file_mmapped, filedata.file_size, advice);
+  }
+  
+  void release_mmapped_buffer(mmapped_file_data &filedata) {
+    if (filedata.file_descriptor != -1) {
+      close(filedata.file_descriptor);
+    }
+    if (munmap(filedata.file_mmapped, filedata.file_size) == -1) {
+      ERROR_EXIT(1, "munmap error\n");
+    }
+  }
+  
+} // namespace Arpa2Lira
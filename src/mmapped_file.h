@@ -0,0 +1,54 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef MMAPPED_FILE_H
+#define MMAPPED_FILE_H
+
+#include <cstddef>
+
+namespace Arpa2Lira {
+
+  struct mmapped_file_data {
+    // NOT USED AprilUtils::UniquePtr<char []> filename;
+    int file_descriptor;
+    size_t file_size;
+    char *file_mmapped;
+  };
+
+  /// mmaps the given file in read-only mode
+  void read_mmapped_buffer(mmapped_file_data &filedata, const char *filename);
+  /// creates an anonymous read-write mmap of the given size, following the
+  /// huge pages and prefault policies of Config
+  void create_mmapped_buffer(mmapped_file_data &filedata, size_t filesize);
+  /// creates a read-write mmap of the given size backed by a sparse temporary
+  /// file in Config temporary directory, so it can be larger than memory
+  void create_file_mmapped_buffer(mmapped_file_data &filedata,
+                                  size_t filesize);
+  /// mmaps a section of an open file in copy-on-write mode, so the buffer
+  /// can be modified without changing the file, offset must be a multiple of
+  /// the page size
+  void map_file_section(mmapped_file_data &filedata, int fd,
+                        size_t offset, size_t size);
+  /// madvise() hint for the whole buffer, it is ignored on failure
+  void advise_mmapped_buffer(mmapped_file_data &filedata, int advice);
+  void release_mmapped_buffer(mmapped_file_data &filedata);
+  
+} // namespace Arpa2Lira
+
+#endif // MMAPPED_FILE_H
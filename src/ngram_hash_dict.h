@@ -0,0 +1,142 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef NGRAM_HASH_DICT_H
+#define NGRAM_HASH_DICT_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "murmur_hash.h"
+
+namespace Arpa2Lira {
+
+  /// Open addressing dictionary (linear probing) which maps n-grams, given as
+  /// vectors of word ids, into non-negative integers. Every n-gram length has
+  /// its own table, where each slot stores the value followed by the n-gram
+  /// words, so a lookup usually touches only one cache line.
+  class NgramHashDict {
+    enum { EMPTY = -1 };
+    static const size_t MIN_CAPACITY = 1024u;
+
+    struct Table {
+      size_t mask; // capacity - 1, capacity is always a power of two
+      size_t size; // number of stored n-grams
+      std::vector<int> slots; // (value, word_1, ..., word_n) for every slot
+      Table() : mask(0), size(0) { }
+    };
+    std::vector<Table> tables; // indexed by n-gram length
+
+    static size_t hash(const int *k, int n) {
+      return static_cast<size_t>(MurmurHash64(k, sizeof(int)*n));
+    }
+
+    static size_t capacity_for(size_t count) {
+      size_t capacity = MIN_CAPACITY;
+      while (capacity*3 < count*4) capacity <<= 1; // load factor <= 0.75
+      return capacity;
+    }
+    
+    /// Returns the slot position of the given n-gram, or the empty slot where
+    /// it should be inserted
+    static size_t find_slot(const Table &t, const int *k, int n) {
+      const size_t stride = n+1;
+      size_t pos = hash(k, n) & t.mask;
+      for (;;) {
+        const int *slot = t.slots.data() + pos*stride;
+        if (slot[0] == EMPTY || memcmp(slot+1, k, sizeof(int)*n) == 0) {
+          return pos;
+        }
+        pos = (pos + 1) & t.mask;
+      }
+    }
+
+    static void rehash(Table &t, int n, size_t capacity) {
+      const size_t stride = n+1;
+      std::vector<int> old_slots;
+      old_slots.swap(t.slots);
+      t.slots.assign(capacity*stride, EMPTY);
+      t.mask = capacity - 1;
+      for (size_t i=0; i<old_slots.size(); i+=stride) {
+        if (old_slots[i] != EMPTY) {
+          size_t pos = find_slot(t, &old_slots[i+1], n);
+          memcpy(&t.slots[pos*stride], &old_slots[i], sizeof(int)*stride);
+        }
+      }
+    }
+
+    Table &get_table(int n) {
+      if (static_cast<int>(tables.size()) <= n) tables.resize(n+1);
+      Table &t = tables[n];
+      if (t.slots.empty()) rehash(t, n, MIN_CAPACITY);
+      return t;
+    }
+    
+  public:
+    /// Prepares the table of n-grams of length n to store count elements
+    void reserve(int n, size_t count) {
+      Table &t = get_table(n);
+      size_t capacity = capacity_for(count);
+      if (capacity > t.mask + 1) rehash(t, n, capacity);
+    }
+    
+    bool get(const int *k, int n, int &value) const {
+      if (static_cast<int>(tables.size()) <= n || tables[n].slots.empty()) {
+        return false;
+      }
+      const Table &t = tables[n];
+      const int *slot = t.slots.data() + find_slot(t, k, n)*(n+1);
+      if (slot[0] == EMPTY) return false;
+      value = slot[0];
+      return true;
+    }
+    
+    bool exists(const int *k, int n) const {
+      int value;
+      return get(k, n, value);
+    }
+    
+    void set(const int *k, int n, int value) {
+      Table &t = get_table(n);
+      int *slot = t.slots.data() + find_slot(t, k, n)*(n+1);
+      if (slot[0] == EMPTY) {
+        if ((t.size + 1)*4 > (t.mask + 1)*3) {
+          rehash(t, n, (t.mask + 1) << 1);
+          slot = t.slots.data() + find_slot(t, k, n)*(n+1);
+        }
+        memcpy(slot+1, k, sizeof(int)*n);
+        t.size++;
+      }
+      slot[0] = value;
+    }
+
+    /// Removes all n-grams and frees the memory of the tables
+    void clear() {
+      std::vector<Table>().swap(tables);
+    }
+
+    size_t size(int n) const {
+      return (static_cast<int>(tables.size()) <= n) ? 0u : tables[n].size;
+    }
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // NGRAM_HASH_DICT_H
@@ -0,0 +1,151 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+extern "C" {
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+}
+
+#include <cstring>
+
+// from APRIL
+#include "april-ann.h"
+
+// from Arpa2Lira
+#include "config.h"
+#include "parallel_compressor.h"
+
+namespace Arpa2Lira {
+
+  ParallelCompressor::ParallelCompressor(AprilIO::StreamInterface *dest,
+                                         Format format, int level) :
+    dest(dest), format(format), level(level) {
+#ifndef HAVE_ZSTD
+    if (format == ZSTD) {
+      ERROR_EXIT(1, "Unable to write zstd output, compiled without zstd "
+                 "support\n");
+    }
+#endif
+    if (this->level < 0) {
+      this->level = (format == GZIP) ? Z_DEFAULT_COMPRESSION : 3;
+    }
+    block.reserve(BLOCK_SIZE);
+  }
+
+  ParallelCompressor::~ParallelCompressor() {
+    finish();
+  }
+
+  void ParallelCompressor::put(const char *src, size_t len) {
+    while (len > 0u) {
+      size_t n = AprilUtils::min(len, BLOCK_SIZE - block.size());
+      block.insert(block.end(), src, src + n);
+      src += n;
+      len -= n;
+      if (block.size() == BLOCK_SIZE) submit_block();
+    }
+  }
+
+  void ParallelCompressor::finish() {
+    if (!block.empty()) submit_block();
+    while (!pending.empty()) write_oldest_block();
+  }
+
+  bool ParallelCompressor::format_from_filename(const char *filename,
+                                                Format &format) {
+    size_t len = strlen(filename);
+    if (len >= 3 && strcmp(filename + len - 3, ".gz") == 0) {
+      format = GZIP;
+      return true;
+    }
+    if (len >= 4 && strcmp(filename + len - 4, ".zst") == 0) {
+      format = ZSTD;
+      return true;
+    }
+    return false;
+  }
+
+  // At most two blocks per thread are in flight, so memory is bounded and
+  // the writer thread blocks while workers are busy
+  void ParallelCompressor::submit_block() {
+    const size_t max_pending = 2*Config::getNumberOfThreads() + 1;
+    while (pending.size() >= max_pending) write_oldest_block();
+    std::vector<char> *src = new std::vector<char>();
+    src->swap(block);
+    block.reserve(BLOCK_SIZE);
+    const Format format = this->format;
+    const int level = this->level;
+    pending.push_back(Config::thread_pool->enqueue([src, format, level]() {
+          AprilUtils::UniquePtr< std::vector<char> > data(src);
+          return (format == GZIP) ?
+            compress_gzip(*data, level) : compress_zstd(*data, level);
+        }));
+  }
+
+  void ParallelCompressor::write_oldest_block() {
+    std::vector<char> compressed = pending.front().get();
+    pending.pop_front();
+    dest->put(compressed.data(), compressed.size());
+  }
+
+  std::vector<char> ParallelCompressor::compress_gzip(const std::vector<char> &src,
+                                                      int level) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    // 15 window bits plus 16 writes a gzip header and trailer
+    if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      ERROR_EXIT(1, "Unable to initialize gzip compression\n");
+    }
+    std::vector<char> dest(deflateBound(&strm, src.size()));
+    strm.next_in   = (Bytef*)src.data();
+    strm.avail_in  = src.size();
+    strm.next_out  = (Bytef*)dest.data();
+    strm.avail_out = dest.size();
+    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+      ERROR_EXIT(1, "Error compressing gzip output\n");
+    }
+    dest.resize(strm.total_out);
+    deflateEnd(&strm);
+    return dest;
+  }
+  
+  std::vector<char> ParallelCompressor::compress_zstd(const std::vector<char> &src,
+                                                      int level) {
+#ifdef HAVE_ZSTD
+    std::vector<char> dest(ZSTD_compressBound(src.size()));
+    size_t n = ZSTD_compress(dest.data(), dest.size(),
+                             src.data(), src.size(), level);
+    if (ZSTD_isError(n)) {
+      ERROR_EXIT1(1, "Error compressing zstd output: %s\n",
+                  ZSTD_getErrorName(n));
+    }
+    dest.resize(n);
+    return dest;
+#else
+    UNUSED_VARIABLE(src);
+    UNUSED_VARIABLE(level);
+    ERROR_EXIT(1, "Compiled without zstd support\n");
+    return std::vector<char>();
+#endif
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef PARALLEL_COMPRESSOR_H
+#define PARALLEL_COMPRESSOR_H
+
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <vector>
+
+// from APRIL
+#include "april-ann.h"
+
+namespace Arpa2Lira {
+
+  /// Compresses the output in independent blocks on Config::thread_pool, and
+  /// writes them in order to the destination stream. Every block is a gzip
+  /// member or a zstd frame, so the result is a standard multi-member gzip or
+  /// multi-frame zstd file (as pigz does), readable by the usual tools.
+  class ParallelCompressor {
+  public:
+    enum Format {
+      GZIP,
+      ZSTD
+    };
+    static const size_t BLOCK_SIZE = 1u<<20;
+    
+    ParallelCompressor(AprilIO::StreamInterface *dest, Format format,
+                       int level = -1);
+    ~ParallelCompressor();
+
+    void put(const char *src, size_t len);
+    /// Compresses the last block and writes all pending blocks
+    void finish();
+
+    /// Returns true if the filename extension is .gz or .zst, and the format
+    static bool format_from_filename(const char *filename, Format &format);
+    
+  private:
+    AprilIO::StreamInterface *dest;
+    Format format;
+    int level;
+    std::vector<char> block;
+    std::deque< std::future< std::vector<char> > > pending;
+
+    ParallelCompressor(const ParallelCompressor &);
+    ParallelCompressor &operator=(const ParallelCompressor &);
+    
+    void submit_block();
+    void write_oldest_block();
+    static std::vector<char> compress_gzip(const std::vector<char> &src,
+                                           int level);
+    static std::vector<char> compress_zstd(const std::vector<char> &src,
+                                           int level);
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // PARALLEL_COMPRESSOR_H
@@ -0,0 +1,122 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "april-ann.h"
+
+#include "quantizer.h"
+
+namespace Arpa2Lira {
+
+  // The sample is sorted, so every cluster is a contiguous segment of it and
+  // Lloyd iterations only need prefix sums: cluster limits are the middle
+  // points between consecutive centroids and centroids are segment means.
+  void Codebook::train(std::vector<float> &sample, int bits, float log_zero) {
+    assert(bits > 1 && bits <= 16);
+    this->log_zero = log_zero;
+    const size_t num_values = size_t(1u) << bits;
+    const size_t k = num_values - 1u; // code 0 is logZero
+    values.assign(1u, log_zero);
+    
+    // remove logZero values and decimate large samples
+    sample.erase(std::remove_if(sample.begin(), sample.end(),
+                                [log_zero](float v) { return v <= log_zero; }),
+                 sample.end());
+    if (sample.size() > MAX_TRAINING_SIZE) {
+      const size_t step = (sample.size() + MAX_TRAINING_SIZE - 1u) / MAX_TRAINING_SIZE;
+      size_t j = 0;
+      for (size_t i=0; i<sample.size(); i+=step) sample[j++] = sample[i];
+      sample.resize(j);
+    }
+    std::sort(sample.begin(), sample.end());
+    const size_t n = sample.size();
+    
+    std::vector<float> centroids;
+    if (n > 0u) {
+      // when there are few distinct values, they are the codebook
+      std::vector<float> distinct;
+      for (size_t i=0; i<n && distinct.size()<=k; ++i) {
+        if (distinct.empty() || distinct.back() != sample[i]) {
+          distinct.push_back(sample[i]);
+        }
+      }
+      if (distinct.size() <= k) {
+        centroids.swap(distinct);
+      }
+      else {
+        std::vector<double> prefix(n + 1u);
+        prefix[0] = 0.0;
+        for (size_t i=0; i<n; ++i) prefix[i+1] = prefix[i] + sample[i];
+        // initialization with equal size bins (quantiles)
+        std::vector<size_t> limits(k + 1u);
+        for (size_t c=0; c<=k; ++c) limits[c] = (n * c) / k;
+        centroids.resize(k);
+        for (int it=0; it<MAX_ITERATIONS; ++it) {
+          bool changed = false;
+          for (size_t c=0; c<k; ++c) {
+            if (limits[c+1] > limits[c]) {
+              float mean = static_cast<float>( (prefix[limits[c+1]] - prefix[limits[c]]) /
+                                               (limits[c+1] - limits[c]) );
+              if (it == 0 || mean != centroids[c]) changed = true;
+              centroids[c] = mean;
+            }
+            else if (it == 0) { // empty bin, it is placed next to the previous
+              centroids[c] = (c > 0) ? centroids[c-1] : sample[0];
+            }
+          }
+          if (!changed) break;
+          for (size_t c=1; c<k; ++c) {
+            const float middle = 0.5f*(centroids[c-1] + centroids[c]);
+            limits[c] = std::lower_bound(sample.begin(), sample.end(), middle) -
+              sample.begin();
+            limits[c] = AprilUtils::max(limits[c], limits[c-1]);
+          }
+        }
+        std::sort(centroids.begin(), centroids.end());
+      }
+    }
+    values.insert(values.end(), centroids.begin(), centroids.end());
+    values.resize(num_values, values.back());
+  }
+
+  int Codebook::encode(float v) const {
+    int code = 0;
+    if (v > log_zero && values.size() > 1u) {
+      std::vector<float>::const_iterator it =
+        std::lower_bound(values.begin() + 1, values.end(), v);
+      if (it == values.end()) {
+        --it;
+      }
+      else if (it != values.begin() + 1 && (v - *(it-1)) <= (*it - v)) {
+        --it;
+      }
+      code = it - values.begin();
+    }
+    return code;
+  }
+
+  float QuantizationError::get_rms_error() const {
+    return (count == 0) ? 0.0f :
+      static_cast<float>(std::sqrt(sum_sq_error / count));
+  }
+  
+} // namespace Arpa2Lira
@@ -0,0 +1,77 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace Arpa2Lira {
+
+  /// Scalar codebook of 2^bits log probabilities trained by 1-D k-means. Code
+  /// 0 is reserved for logZero, the rest of values are sorted in increasing
+  /// order (the last one is repeated when there are not enough clusters).
+  class Codebook {
+    std::vector<float> values;
+    float log_zero;
+    
+  public:
+    /// Maximum number of values used by train(), larger samples are decimated
+    static const size_t MAX_TRAINING_SIZE = 1u<<22;
+    /// Number of Lloyd iterations of train()
+    static const int MAX_ITERATIONS = 20;
+    
+    Codebook() : log_zero(0.0f) { }
+
+    /// Trains the codebook with the given sample, which is sorted in place;
+    /// values <= log_zero are encoded as code 0
+    void train(std::vector<float> &sample, int bits, float log_zero);
+    
+    /// Returns the code of the nearest value
+    int encode(float v) const;
+
+    float decode(int code) const { return values[code]; }
+    size_t size() const { return values.size(); }
+    const float *get() const { return values.data(); }
+  };
+
+  /// Accumulates the error of quantized values, logZero values are counted
+  /// but they are always exact
+  class QuantizationError {
+    size_t count;
+    double sum_sq_error;
+    float  max_error;
+  public:
+    QuantizationError() : count(0), sum_sq_error(0.0), max_error(0.0f) { }
+    void add(float v, float quantized) {
+      const double error = (v > quantized) ? v - quantized : quantized - v;
+      count++;
+      sum_sq_error += error*error;
+      if (error > max_error) max_error = error;
+    }
+    size_t get_count() const { return count; }
+    float get_rms_error() const;
+    float get_max_error() const { return max_error; }
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // QUANTIZER_H
@@ -1,5 +1,9 @@
 /*
   Taken from: https://github.com/progschj/ThreadPool
+
+  Altered version: the single task queue has been replaced by a work-stealing
+  scheduler with one deque per worker, and parallel_for/parallel_reduce have
+  been added. enqueue() keeps the original interface.
   
   Copyright (c) 2012 Jakob Progsch, Václav Zeman
 
@@ -24,15 +28,18 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include <vector>
-#include <queue>
-#include <memory>
-#include <thread>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <future>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 class ThreadPool {
 public:
@@ -41,45 +48,167 @@ public:
   auto enqueue(F&& f, Args&&... args) 
     -> std::future<typename std::result_of<F(Args...)>::type>;
   ~ThreadPool();
-  bool empty() { return tasks.empty(); }
+  bool empty() { return queued.load() == 0; }
+  size_t size() const { return workers.size(); }
+
+  /// Calls f(chunk_begin, chunk_end) for consecutive chunks of grain
+  /// elements of [begin,end). The calling thread runs chunks too, and it
+  /// returns when all of them are done. No memory is allocated per chunk.
+  template<class F>
+  void parallel_for(size_t begin, size_t end, size_t grain, F f);
+
+  /// Returns combine(...combine(combine(init, map(c0)), map(c1))..., map(cn))
+  /// where ci are the chunks of parallel_for. Chunk results are combined in
+  /// order, so the result does not depend on the scheduling.
+  template<class T, class Map, class Combine>
+  T parallel_reduce(size_t begin, size_t end, size_t grain, T init,
+                    Map map, Combine combine);
+  
 private:
+  // tasks are a function pointer and its argument, so data-parallel loops
+  // are scheduled without allocations
+  struct Task {
+    void (*run)(void *);
+    void *arg;
+  };
+  struct Worker {
+    std::deque<Task> tasks;
+    std::mutex mutex;
+  };
+
+  // a loop shared by the caller and the helper tasks, chunks are claimed
+  // with an atomic counter
+  template<class F>
+  struct Loop {
+    const F *f;
+    size_t begin, end, grain, num_chunks;
+    std::atomic<size_t> next_chunk;
+    std::atomic<size_t> pending_helpers;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    void run_chunks();
+    static void run_helper(void *arg);
+  };
+
   // need to keep track of threads so we can join them
   std::vector< std::thread > workers;
-  // the task queue
-  std::queue< std::function<void()> > tasks;
+  std::vector< std::unique_ptr<Worker> > queues;
+  std::atomic<size_t> queued; // tasks in the queues
+  std::atomic<size_t> next_queue; // round robin for external threads
     
-  // synchronization
-  std::mutex queue_mutex;
+  // synchronization of sleeping workers
+  std::mutex sleep_mutex;
   std::condition_variable condition;
   bool stop;
+
+  // pool and queue index of the calling worker thread
+  static ThreadPool *&current_pool() {
+    static thread_local ThreadPool *pool = 0;
+    return pool;
+  }
+  static size_t &current_index() {
+    static thread_local size_t index = 0;
+    return index;
+  }
+  // index of the queue of the calling thread in this pool, or -1
+  int current_queue() const;
+  void push(const Task &task);
+  bool pop(size_t q, Task &task);
+  bool steal(size_t q, Task &task);
+  bool try_run_task(size_t q);
+  void worker_loop(size_t q);
 };
- 
+
+inline int ThreadPool::current_queue() const {
+  return (current_pool() == this) ? static_cast<int>(current_index()) : -1;
+}
+
 // the constructor just launches some amount of workers
 inline ThreadPool::ThreadPool(size_t threads)
-  :   stop(false)
+  :   queued(0), next_queue(0), stop(false)
 {
   for(size_t i = 0;i<threads;++i)
-    workers.emplace_back(
-                         [this]
-                         {
-                           for(;;)
-                             {
-                               std::function<void()> task;
-
-                               {
-                                 std::unique_lock<std::mutex> lock(this->queue_mutex);
-                                 this->condition.wait(lock,
-                                                      [this]{ return this->stop || !this->tasks.empty(); });
-                                 if(this->stop && this->tasks.empty())
-                                   return;
-                                 task = std::move(this->tasks.front());
-                                 this->tasks.pop();
-                               }
-
-                               task();
-                             }
-                         }
-                         );
+    queues.emplace_back(new Worker());
+  for(size_t i = 0;i<threads;++i)
+    workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+inline void ThreadPool::push(const Task &task)
+{
+  if(queues.empty()) { // without workers tasks are run by the caller
+    task.run(task.arg);
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    // don't allow enqueueing after stopping the pool
+    if(stop)
+      throw std::runtime_error("enqueue on stopped ThreadPool");
+    queued.fetch_add(1);
+  }
+  int q = current_queue();
+  if(q < 0)
+    q = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+  {
+    std::unique_lock<std::mutex> lock(queues[q]->mutex);
+    queues[q]->tasks.push_back(task);
+  }
+  condition.notify_one();
+}
+
+// the owner takes the oldest task, so tasks submitted by the same thread
+// start in order
+inline bool ThreadPool::pop(size_t q, Task &task)
+{
+  std::unique_lock<std::mutex> lock(queues[q]->mutex);
+  if(queues[q]->tasks.empty())
+    return false;
+  task = queues[q]->tasks.front();
+  queues[q]->tasks.pop_front();
+  queued.fetch_sub(1);
+  return true;
+}
+
+// thieves take the newest task of the other queues
+inline bool ThreadPool::steal(size_t q, Task &task)
+{
+  for(size_t i = 1;i<queues.size();++i) {
+    Worker &victim = *queues[(q + i) % queues.size()];
+    std::unique_lock<std::mutex> lock(victim.mutex);
+    if(!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      queued.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ThreadPool::try_run_task(size_t q)
+{
+  Task task;
+  if(pop(q, task) || steal(q, task)) {
+    task.run(task.arg);
+    return true;
+  }
+  return false;
+}
+
+inline void ThreadPool::worker_loop(size_t q)
+{
+  current_pool() = this;
+  current_index() = q;
+  for(;;)
+    {
+      if(try_run_task(q))
+        continue;
+      std::unique_lock<std::mutex> lock(this->sleep_mutex);
+      this->condition.wait(lock,
+                           [this]{ return this->stop || this->queued.load() > 0; });
+      if(this->stop && this->queued.load() == 0)
+        return;
+    }
 }
 
 // add new work item to the pool
@@ -88,30 +217,114 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
   -> std::future<typename std::result_of<F(Args...)>::type>
 {
   using return_type = typename std::result_of<F(Args...)>::type;
-
-  auto task = std::make_shared< std::packaged_task<return_type()> >(
-                                                                    std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-                                                                    );
-        
+  typedef std::packaged_task<return_type()> task_type;
+  
+  task_type *task = new task_type(std::bind(std::forward<F>(f),
+                                            std::forward<Args>(args)...));
   std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+  Task t;
+  t.run = [](void *arg) {
+    std::unique_ptr<task_type> task(static_cast<task_type*>(arg));
+    (*task)();
+  };
+  t.arg = task;
+  try {
+    push(t);
+  }
+  catch(...) {
+    delete task;
+    throw;
+  }
+  return res;
+}
 
-    // don't allow enqueueing after stopping the pool
-    if(stop)
-      throw std::runtime_error("enqueue on stopped ThreadPool");
+template<class F>
+void ThreadPool::Loop<F>::run_chunks()
+{
+  for(;;) {
+    size_t chunk = next_chunk.fetch_add(1);
+    if(chunk >= num_chunks)
+      return;
+    size_t chunk_begin = begin + chunk*grain;
+    size_t chunk_end = std::min(end, chunk_begin + grain);
+    try {
+      (*f)(chunk_begin, chunk_end);
+    }
+    catch(...) {
+      std::unique_lock<std::mutex> lock(error_mutex);
+      if(!error)
+        error = std::current_exception();
+      next_chunk.store(num_chunks); // cancel the remaining chunks
+    }
+  }
+}
+
+template<class F>
+void ThreadPool::Loop<F>::run_helper(void *arg)
+{
+  Loop<F> *loop = static_cast<Loop<F>*>(arg);
+  loop->run_chunks();
+  loop->pending_helpers.fetch_sub(1, std::memory_order_release);
+}
 
-    tasks.emplace([task](){ (*task)(); });
+template<class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, F f)
+{
+  if(end <= begin)
+    return;
+  if(grain == 0)
+    grain = 1;
+  Loop<F> loop;
+  loop.f = &f;
+  loop.begin = begin;
+  loop.end = end;
+  loop.grain = grain;
+  loop.num_chunks = (end - begin + grain - 1) / grain;
+  loop.next_chunk.store(0);
+  // the caller is one of the participants
+  size_t num_helpers = 0;
+  if(!workers.empty())
+    num_helpers = std::min(loop.num_chunks, workers.size()) - 1;
+  loop.pending_helpers.store(num_helpers);
+  for(size_t i = 0;i<num_helpers;++i) {
+    Task t = { &Loop<F>::run_helper, &loop };
+    push(t);
   }
-  condition.notify_one();
-  return res;
+  loop.run_chunks();
+  // helpers which have not started yet are run here or by other workers,
+  // loop lives in this stack frame until all of them have finished
+  int q = current_queue();
+  while(loop.pending_helpers.load(std::memory_order_acquire) > 0) {
+    if(!try_run_task(q < 0 ? 0 : q))
+      std::this_thread::yield();
+  }
+  if(loop.error)
+    std::rethrow_exception(loop.error);
+}
+
+template<class T, class Map, class Combine>
+T ThreadPool::parallel_reduce(size_t begin, size_t end, size_t grain, T init,
+                              Map map, Combine combine)
+{
+  if(end <= begin)
+    return init;
+  if(grain == 0)
+    grain = 1;
+  std::vector<T> partial((end - begin + grain - 1) / grain, init);
+  parallel_for(begin, end, grain, [&](size_t b, size_t e) {
+      partial[(b - begin) / grain] = map(b, e);
+    });
+  T result = init;
+  for(size_t i = 0;i<partial.size();++i)
+    result = combine(result, partial[i]);
+  return result;
 }
 
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::unique_lock<std::mutex> lock(sleep_mutex);
     stop = true;
   }
   condition.notify_all();
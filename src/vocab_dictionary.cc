@@ -0,0 +1,84 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#include <cctype>
+
+#include "mmapped_file.h"
+#include "vocab_dictionary.h"
+
+namespace Arpa2Lira {
+
+  // The vocabulary file is mmapped and its whitespace separated words are
+  // copied to the arena, which never needs more bytes than the file
+  VocabDictionary::VocabDictionary(const char *vocabFilename) :
+    vocabSize(0u), mask(0u) {
+    mmapped_file_data filedata;
+    read_mmapped_buffer(filedata, vocabFilename);
+    load_words(filedata.file_mmapped,
+               filedata.file_mmapped + filedata.file_size);
+    release_mmapped_buffer(filedata);
+  }
+
+  VocabDictionary::VocabDictionary(const char *words, size_t size) :
+    vocabSize(0u), mask(0u) {
+    load_words(words, words + size);
+  }
+
+  static bool is_word_separator(char c) {
+    return c == '\0' || isspace(static_cast<unsigned char>(c));
+  }
+  
+  void VocabDictionary::load_words(const char *p, const char *end) {
+    arena.reserve(end - p + 1u);
+    offsets.push_back(0u);
+    for (;;) {
+      while (p < end && is_word_separator(*p)) ++p;
+      if (p == end) break;
+      const char *word = p;
+      while (p < end && !is_word_separator(*p)) ++p;
+      arena.insert(arena.end(), word, p);
+      arena.push_back('\0');
+      offsets.push_back(arena.size());
+      ++vocabSize;
+    }
+    
+    size_t capacity = 1024u;
+    while (capacity < 2u*vocabSize) capacity <<= 1; // load factor <= 0.5
+    Slot empty = { 0u, 0u };
+    slots.assign(capacity, empty);
+    mask = capacity - 1u;
+    for (unsigned int id=1; id<=vocabSize; ++id) {
+      insert(id);
+    }
+  }
+
+  void VocabDictionary::insert(unsigned int id) {
+    const char *word = getWord(id);
+    const size_t len = word_length(id);
+    if (lookup(word, len) != UNKNOWN_WORD) {
+      ERROR_EXIT1(1, "Improper dictionary, duplicated word %s found\n", word);
+    }
+    const uint64_t h = hash(word, len);
+    size_t pos = h & mask;
+    while (slots[pos].id != 0) pos = (pos + 1) & mask;
+    slots[pos].id  = id;
+    slots[pos].tag = static_cast<uint32_t>(h >> 32);
+  }
+  
+} // namespace Arpa2Lira
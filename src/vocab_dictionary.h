@@ -0,0 +1,120 @@
+/*
+ * This file is part of Arpa2Lira for APRIL toolkit (A Pattern Recognizer In
+ * Lua).
+ *
+ * Copyright 2015, Salvador España-Boquera, Francisco Zamora-Martinez
+ *
+ * Arpa2Lira is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License version 3 as published by the
+ * Free Software Foundation
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this library; if not, write to the Free Software Foundation, Inc., 59 Temple
+ * Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef VOCAB_DICTIONARY_H
+#define VOCAB_DICTIONARY_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "april-ann.h"
+
+#include "buffered_writer.h"
+#include "murmur_hash.h"
+
+namespace Arpa2Lira {
+
+  /// Vocabulary of the language model, word ids are given by the order of the
+  /// vocabulary file starting at 1. Words are stored '\0' terminated in a
+  /// single arena, and looked up through an open addressing table (linear
+  /// probing) over the arena, so lookups do not allocate memory.
+  class VocabDictionary {
+    struct Slot {
+      uint32_t id;  // 0 means empty slot
+      uint32_t tag; // high bits of the hash, avoids most string comparisons
+    };
+    
+    unsigned int vocabSize;
+    std::vector<char> arena;     // words sorted by id, '\0' terminated
+    std::vector<size_t> offsets; // offsets[id-1] is the first char of id
+    std::vector<Slot> slots;     // capacity is a power of two
+    size_t mask;
+
+    static uint64_t hash(const char *word, size_t len) {
+      return MurmurHash64(word, len);
+    }
+
+    size_t word_length(unsigned int id) const {
+      return offsets[id] - offsets[id-1] - 1u;
+    }
+    
+    void insert(unsigned int id);
+    void load_words(const char *p, const char *end);
+    
+  public:
+    /// Returned for words out of the vocabulary
+    enum { UNKNOWN_WORD = 0 };
+    
+    VocabDictionary(const char *vocabFilename);
+    /// Takes the words from memory, separated by whitespace or '\0' as in
+    /// the vocabulary of binary LIRA files
+    VocabDictionary(const char *words, size_t size);
+    
+    unsigned int get_vocab_size() const {
+      return vocabSize;
+    }
+
+    unsigned int lookup(const char *word, size_t len) const {
+      const uint64_t h = hash(word, len);
+      const uint32_t tag = static_cast<uint32_t>(h >> 32);
+      for (size_t pos = h & mask; slots[pos].id != 0; pos = (pos + 1) & mask) {
+        const Slot &slot = slots[pos];
+        if (slot.tag == tag && word_length(slot.id) == len &&
+            memcmp(&arena[offsets[slot.id-1]], word, len) == 0) {
+          return slot.id;
+        }
+      }
+      return UNKNOWN_WORD;
+    }
+    unsigned int operator()(const char *word) const {
+      return lookup(word, strlen(word));
+    }
+    unsigned int operator()(AprilUtils::constString cs) const {
+      return lookup((const char *)cs, cs.len());
+    }
+    /// Returns the '\0' terminated word of the given id
+    const char *getWord(unsigned int id) const {
+      return &arena[offsets[id-1]];
+    }
+    void getWords(std::vector<const char*> &vec) const {
+      vec.resize(vocabSize);
+      for (unsigned int id=1; id<=vocabSize; ++id)
+        vec[id-1] = getWord(id);
+    }
+    void writeDictionary(BufferedWriter &w) const {
+      for (unsigned int id=1; id<=vocabSize; ++id) {
+        w.put_string(getWord(id));
+        w.put_char('\n');
+      }
+    }
+    /// Size of the dictionary written by writeBinaryDictionary()
+    size_t getBinaryDictionarySize() const {
+      return arena.size();
+    }
+    /// Writes the words sorted by id as '\0' terminated strings
+    void writeBinaryDictionary(BufferedWriter &w) const {
+      w.put_string(arena.data(), arena.size());
+    }
+  };
+  
+} // namespace Arpa2Lira
+
+#endif // VOCAB_DICTIONARY_H